@@ -0,0 +1,72 @@
+"""domino_bench の JSON 出力をベースラインと比較するスクリプト
+
+使い方::
+
+    domino_bench --benchmark_out=baseline.json --benchmark_out_format=json
+    # ... 変更を加えてビルドし直す ...
+    domino_bench --benchmark_out=current.json --benchmark_out_format=json
+    python bench/compare_baseline.py baseline.json current.json --threshold 0.05
+
+`--threshold` を超えて遅くなったベンチマークが1つでもあれば終了コード1を返す
+"""
+import argparse
+import json
+import sys
+
+
+def load_times(path: str) -> dict[str, float]:
+    """ベンチマーク名から1反復あたりの実時間 (ns) への辞書を返す。repetitions を使っている場合は median を採用する"""
+    with open(path, encoding="utf-8") as f:
+        report = json.load(f)
+
+    unit_to_ns = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+    times: dict[str, float] = {}
+    aggregated: set[str] = set()
+    for bench in report["benchmarks"]:
+        if bench.get("error_occurred"):
+            continue
+        name = bench.get("run_name", bench["name"])
+        time_ns = bench["real_time"] * unit_to_ns[bench.get("time_unit", "ns")]
+        if bench.get("run_type") == "aggregate":
+            if bench.get("aggregate_name") == "median":
+                times[name] = time_ns
+                aggregated.add(name)
+        elif name not in aggregated:
+            times[name] = time_ns
+    return times
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("baseline", help="ベースラインの JSON ファイル")
+    parser.add_argument("current", help="比較対象の JSON ファイル")
+    parser.add_argument("--threshold", type=float, default=0.05, help="回帰とみなす相対的な遅延。デフォルトは 0.05 (5%%)")
+    args = parser.parse_args()
+
+    baseline = load_times(args.baseline)
+    current = load_times(args.current)
+
+    names = [name for name in baseline if name in current]
+    width = max([len(name) for name in names] + [len("benchmark")])
+    print(f"{'benchmark':<{width}}  {'baseline[us]':>12}  {'current[us]':>12}  {'change':>8}")
+
+    regressions = []
+    for name in names:
+        change = current[name] / baseline[name] - 1.0
+        mark = ""
+        if change > args.threshold:
+            regressions.append(name)
+            mark = "  REGRESSION"
+        print(f"{name:<{width}}  {baseline[name] / 1e3:>12.2f}  {current[name] / 1e3:>12.2f}  {change:>+8.1%}{mark}")
+
+    for name in sorted(set(baseline) ^ set(current)):
+        print(f"[warn] {name} exists only in {'baseline' if name in baseline else 'current'}")
+
+    if regressions:
+        print(f"{len(regressions)} benchmark(s) regressed by more than {args.threshold:.0%}")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,334 @@
+/* Viterbi・トークナイザ・WAV読み込みのマイクロベンチマーク。ONNXモデルは不要 */
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.hpp"
+#include "load_wav.hpp"
+#include "phoneme_transition.hpp"
+#include "viterbi.hpp"
+
+namespace {
+constexpr int kNumTransitionVocab = 556;
+
+/**
+ * @brief モデル出力を模した合成対数確率行列
+ */
+struct SyntheticLogprobs {
+  int len_timeframes = 0;
+  std::vector<float> transition_logprobs;  // len_timeframes x kNumTransitionVocab
+  std::vector<float> blank_logprobs;       // len_timeframes
+  std::vector<int> token_ids;              // num_tokens
+};
+
+SyntheticLogprobs make_logprobs(int const len_timeframes, int const num_tokens, unsigned const seed = 0) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> logprob(-20.0f, 0.0f);
+  std::uniform_int_distribution<int> token(0, kNumTransitionVocab - 1);
+
+  SyntheticLogprobs data;
+  data.len_timeframes = len_timeframes;
+  data.transition_logprobs.resize(static_cast<std::size_t>(len_timeframes) * kNumTransitionVocab);
+  for (float &x : data.transition_logprobs) {
+    x = logprob(rng);
+  }
+  data.blank_logprobs.resize(len_timeframes);
+  for (float &x : data.blank_logprobs) {
+    // blank は遷移トークンより出やすくしておく
+    x = logprob(rng) * 0.05f;
+  }
+  data.token_ids.resize(num_tokens);
+  for (int &x : data.token_ids) {
+    x = token(rng);
+  }
+  return data;
+}
+
+/**
+ * @brief (T, K, min_aligned_time) の格子。アラインメント不可能な組み合わせは除く
+ */
+void viterbi_grid(benchmark::internal::Benchmark *b) {
+  for (int const T : {1000, 4000, 16000}) {
+    for (int const K : {32, 128, 512}) {
+      for (int const N : {1, 3, 5}) {
+        if (N * (K - 1) + 1 <= T) {
+          b->Args({T, K, N});
+        }
+      }
+    }
+  }
+  b->ArgNames({"T", "K", "N"});
+}
+
+void set_lattice_counters(benchmark::State &state, int const T, int const K) {
+  std::int64_t const lattice_size = static_cast<std::int64_t>(T) * (2 * K + 1);
+  state.SetItemsProcessed(state.iterations() * lattice_size);
+  state.counters["lattice"] = static_cast<double>(lattice_size);
+}
+
+void BM_ViterbiInit(benchmark::State &state) {
+  int const T = state.range(0);
+  int const K = state.range(1);
+  SyntheticLogprobs const data = make_logprobs(T, K);
+  std::vector<float> log_emission_probs(static_cast<std::size_t>(T) * (2 * K + 1));
+  for (auto _ : state) {
+    viterbi_init(data.transition_logprobs.data(), data.blank_logprobs.data(), data.token_ids, T,
+                 kNumTransitionVocab, log_emission_probs);
+    benchmark::DoNotOptimize(log_emission_probs.data());
+    benchmark::ClobberMemory();
+  }
+  set_lattice_counters(state, T, K);
+}
+
+void BM_ViterbiForward(benchmark::State &state) {
+  int const T = state.range(0);
+  int const K = state.range(1);
+  int const N = state.range(2);
+  SyntheticLogprobs const data = make_logprobs(T, K);
+  std::vector<float> log_emission_probs(static_cast<std::size_t>(T) * (2 * K + 1));
+  viterbi_init(data.transition_logprobs.data(), data.blank_logprobs.data(), data.token_ids, T, kNumTransitionVocab,
+               log_emission_probs);
+  std::vector<bool> is_transition(log_emission_probs.size(), false);
+  for (auto _ : state) {
+    std::vector<float> forward_logprobs = viterbi_forward(T, 2 * K + 1, log_emission_probs, is_transition, N);
+    benchmark::DoNotOptimize(forward_logprobs.data());
+  }
+  set_lattice_counters(state, T, K);
+}
+
+/**
+ * @brief 並列版の前向き計算。(T, K, min_aligned_time, スレッド数) の格子
+ */
+void viterbi_parallel_grid(benchmark::internal::Benchmark *b) {
+  for (int const T : {4000, 16000}) {
+    for (int const K : {512, 1024}) {
+      for (int const threads : {1, 2, 4, 8}) {
+        b->Args({T, K, 3, threads});
+      }
+    }
+  }
+  b->ArgNames({"T", "K", "N", "threads"});
+}
+
+void BM_ViterbiForwardParallel(benchmark::State &state) {
+  int const T = state.range(0);
+  int const K = state.range(1);
+  int const N = state.range(2);
+  int const num_threads = state.range(3);
+  SyntheticLogprobs const data = make_logprobs(T, K);
+  std::vector<float> log_emission_probs(static_cast<std::size_t>(T) * (2 * K + 1));
+  viterbi_init(data.transition_logprobs.data(), data.blank_logprobs.data(), data.token_ids, T, kNumTransitionVocab,
+               log_emission_probs);
+  std::vector<bool> is_transition(log_emission_probs.size(), false);
+  for (auto _ : state) {
+    std::vector<float> forward_logprobs =
+        viterbi_forward_parallel(T, 2 * K + 1, log_emission_probs, is_transition, N, num_threads);
+    benchmark::DoNotOptimize(forward_logprobs.data());
+  }
+  set_lattice_counters(state, T, K);
+}
+
+void BM_ViterbiBacktrace(benchmark::State &state) {
+  int const T = state.range(0);
+  int const K = state.range(1);
+  int const N = state.range(2);
+  SyntheticLogprobs const data = make_logprobs(T, K);
+  std::vector<float> log_emission_probs(static_cast<std::size_t>(T) * (2 * K + 1));
+  viterbi_init(data.transition_logprobs.data(), data.blank_logprobs.data(), data.token_ids, T, kNumTransitionVocab,
+               log_emission_probs);
+  std::vector<bool> is_transition(log_emission_probs.size(), false);
+  viterbi_forward(T, 2 * K + 1, log_emission_probs, is_transition, N);
+  std::vector<int> transition_timeframes(K, 0);
+  for (auto _ : state) {
+    viterbi_backtrace(T, K, is_transition, N, transition_timeframes);
+    benchmark::DoNotOptimize(transition_timeframes.data());
+  }
+  set_lattice_counters(state, T, K);
+}
+
+void BM_ViterbiPosterior(benchmark::State &state) {
+  int const T = state.range(0);
+  int const K = state.range(1);
+  int const N = state.range(2);
+  SyntheticLogprobs const data = make_logprobs(T, K);
+  std::vector<float> log_emission_probs(static_cast<std::size_t>(T) * (2 * K + 1));
+  viterbi_init(data.transition_logprobs.data(), data.blank_logprobs.data(), data.token_ids, T, kNumTransitionVocab,
+               log_emission_probs);
+  std::vector<bool> is_transition(log_emission_probs.size(), false);
+  viterbi_forward(T, 2 * K + 1, log_emission_probs, is_transition, N);
+  std::vector<int> transition_timeframes(K, 0);
+  viterbi_backtrace(T, K, is_transition, N, transition_timeframes);
+  std::vector<float> boundary_confidences;
+  for (auto _ : state) {
+    viterbi_posterior(T, 2 * K + 1, log_emission_probs, N, transition_timeframes, 2, boundary_confidences);
+    benchmark::DoNotOptimize(boundary_confidences.data());
+  }
+  set_lattice_counters(state, T, K);
+}
+
+void BM_SolveViterbi(benchmark::State &state) {
+  int const T = state.range(0);
+  int const K = state.range(1);
+  int const N = state.range(2);
+  SyntheticLogprobs const data = make_logprobs(T, K);
+  std::vector<int> transition_timeframes(K, 0);
+  for (auto _ : state) {
+    solve_viterbi(T, kNumTransitionVocab, data.transition_logprobs.data(), data.blank_logprobs.data(), N,
+                  data.token_ids, transition_timeframes);
+    benchmark::DoNotOptimize(transition_timeframes.data());
+  }
+  set_lattice_counters(state, T, K);
+}
+
+/**
+ * @brief phoneme_transitions.txt に定義された遷移だけを辿って、pau で始まり pau で終わる音素列を作る
+ */
+std::string make_transcript(PhonemeTransitionTokenizer &tokenizer, int const num_phonemes, unsigned const seed = 0) {
+  std::vector<std::vector<std::string>> next_phonemes;
+  std::vector<std::string> phoneme_names;
+  std::vector<std::string> last_phonemes;  // pau へ遷移できる音素
+  auto phoneme_id = [&](std::string const &phoneme) {
+    for (int i = 0; i < phoneme_names.size(); ++i) {
+      if (phoneme_names[i] == phoneme) {
+        return i;
+      }
+    }
+    phoneme_names.push_back(phoneme);
+    next_phonemes.emplace_back();
+    return static_cast<int>(phoneme_names.size() - 1);
+  };
+  for (int token_id = 0; token_id < kNumTransitionVocab; ++token_id) {
+    std::vector<std::string> const transition = tokenizer.to_phonemes({token_id});
+    // pau への遷移は末尾でだけ使う
+    if (transition[1] == "pau") {
+      last_phonemes.push_back(transition[0]);
+    } else {
+      next_phonemes[phoneme_id(transition[0])].push_back(transition[1]);
+      phoneme_id(transition[1]);
+    }
+  }
+
+  std::mt19937 rng(seed);
+  std::ostringstream ss;
+  std::string phoneme = "pau";
+  ss << phoneme;
+  for (int i = 1; i < num_phonemes - 1; ++i) {
+    std::vector<std::string> const &candidates = next_phonemes[phoneme_id(phoneme)];
+    phoneme = candidates[std::uniform_int_distribution<std::size_t>(0, candidates.size() - 1)(rng)];
+    ss << " " << phoneme;
+  }
+  // 末尾の pau へ遷移できる音素が出るまで延ばす
+  while (std::find(last_phonemes.begin(), last_phonemes.end(), phoneme) == last_phonemes.end()) {
+    std::vector<std::string> const &candidates = next_phonemes[phoneme_id(phoneme)];
+    phoneme = candidates[std::uniform_int_distribution<std::size_t>(0, candidates.size() - 1)(rng)];
+    ss << " " << phoneme;
+  }
+  ss << " pau";
+  return ss.str();
+}
+
+void BM_ReadPhonemes(benchmark::State &state) {
+  PhonemeTransitionTokenizer tokenizer;
+  std::string const transcript = make_transcript(tokenizer, state.range(0));
+  for (auto _ : state) {
+    std::istringstream ss{transcript};
+    std::vector<int> token_ids = tokenizer.read_phonemes(ss);
+    benchmark::DoNotOptimize(token_ids.data());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() * static_cast<std::int64_t>(transcript.size()));
+}
+
+/**
+ * @brief 16kHz・16bit・モノラルの WAV ファイルを書き出す
+ */
+void write_wav(std::filesystem::path const &file, std::uint32_t const num_samples) {
+  auto write_u32 = [](std::ofstream &ofs, std::uint32_t x) { ofs.write(reinterpret_cast<char const *>(&x), 4); };
+  auto write_u16 = [](std::ofstream &ofs, std::uint16_t x) { ofs.write(reinterpret_cast<char const *>(&x), 2); };
+
+  std::ofstream ofs(file, std::ios::binary);
+  ofs.write("RIFF", 4);
+  write_u32(ofs, 36 + num_samples * 2);
+  ofs.write("WAVE", 4);
+  ofs.write("fmt ", 4);
+  write_u32(ofs, 16);
+  write_u16(ofs, 1);
+  write_u16(ofs, 1);
+  write_u32(ofs, 16'000);
+  write_u32(ofs, 32'000);
+  write_u16(ofs, 2);
+  write_u16(ofs, 16);
+  ofs.write("data", 4);
+  write_u32(ofs, num_samples * 2);
+
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<int> sample(-32768, 32767);
+  std::vector<std::int16_t> data(num_samples);
+  for (std::int16_t &x : data) {
+    x = static_cast<std::int16_t>(sample(rng));
+  }
+  ofs.write(reinterpret_cast<char const *>(data.data()), data.size() * sizeof(std::int16_t));
+}
+
+void BM_LoadWav(benchmark::State &state) {
+  std::uint32_t const num_samples = static_cast<std::uint32_t>(state.range(0)) * 16'000;
+  std::filesystem::path const wav_file =
+      std::filesystem::temp_directory_path() / ("domino_bench_" + std::to_string(state.range(0)) + "s.wav");
+  write_wav(wav_file, num_samples);
+
+  std::vector<float> wav_data;
+  for (auto _ : state) {
+    if (load_wav(wav_file.string().c_str(), wav_data) != 0) {
+      state.SkipWithError("load_wav failed");
+      break;
+    }
+    benchmark::DoNotOptimize(wav_data.data());
+  }
+  state.SetBytesProcessed(state.iterations() * static_cast<std::int64_t>(num_samples) * 2);
+  std::filesystem::remove(wav_file);
+}
+
+/**
+ * @brief パイプラインのステージ間のキューに、別スレッドから要素を流したときのスループット
+ */
+void BM_ChannelThroughput(benchmark::State &state) {
+  constexpr int kNumItems = 100'000;
+  for (auto _ : state) {
+    domino::Channel<std::unique_ptr<int>> channel(state.range(0), 1);
+    std::thread producer([&channel]() {
+      for (int i = 0; i < kNumItems; ++i) {
+        channel.push(std::make_unique<int>(i));
+      }
+      channel.close();
+    });
+    std::int64_t sum = 0;
+    for (std::unique_ptr<int> item; channel.pop(item);) {
+      sum += *item;
+    }
+    producer.join();
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * kNumItems);
+}
+}  // namespace
+
+BENCHMARK(BM_ViterbiInit)->Apply(viterbi_grid)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ViterbiForward)->Apply(viterbi_grid)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ViterbiForwardParallel)->Apply(viterbi_parallel_grid)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_ViterbiBacktrace)->Apply(viterbi_grid)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ViterbiPosterior)->Apply(viterbi_grid)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_SolveViterbi)->Apply(viterbi_grid)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ReadPhonemes)->ArgName("phonemes")->Arg(100)->Arg(1000)->Arg(10000)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_LoadWav)->ArgName("seconds")->Arg(1)->Arg(10)->Arg(60)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ChannelThroughput)->ArgName("capacity")->Arg(4)->Arg(64)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+BENCHMARK_MAIN();
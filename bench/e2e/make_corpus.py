@@ -0,0 +1,86 @@
+"""スループット計測用の合成コーパスを作るスクリプト
+
+`{output_dir}/{id}.wav` (16kHz・16bit・モノラル) と、`phoneme_transitions.txt` に定義された遷移だけからなる
+`{output_dir}/{id}.txt` (半角スペース区切りの音素列) の組を `--num_files` 個書き出す。
+音声長は対数正規分布に従い、`--min_sec` と `--max_sec` で打ち切る。標準ライブラリだけで動く。
+"""
+import argparse
+import math
+import random
+import struct
+import wave
+from pathlib import Path
+
+TRANSITIONS_FILE = Path(__file__).resolve().parents[2] / "src" / "phoneme_transitions.txt"
+
+
+def load_transitions(path: Path = TRANSITIONS_FILE) -> dict[str, list[str]]:
+    """音素から遷移可能な次の音素の一覧への辞書を返す"""
+    text = path.read_text(encoding="utf-8").replace('R"(', "").replace(')"', "")
+    next_phonemes: dict[str, list[str]] = {}
+    for line in text.splitlines():
+        if not line.strip():
+            continue
+        from_phoneme, to_phoneme = line.split(" ")
+        next_phonemes.setdefault(from_phoneme, []).append(to_phoneme)
+        next_phonemes.setdefault(to_phoneme, [])
+    return next_phonemes
+
+
+def make_phonemes(next_phonemes: dict[str, list[str]], num_phonemes: int, rng: random.Random) -> list[str]:
+    """pau で始まり pau で終わる、定義済みの遷移だけを辿った音素列を作る"""
+    phonemes = ["pau"]
+    while len(phonemes) < num_phonemes - 1 or "pau" not in next_phonemes[phonemes[-1]]:
+        candidates = [p for p in next_phonemes[phonemes[-1]] if p != "pau"]
+        phonemes.append(rng.choice(candidates))
+    phonemes.append("pau")
+    return phonemes
+
+
+def write_wav(path: Path, num_samples: int, rng: random.Random) -> None:
+    """音素数に依存しない、振幅変調したノイズ + 正弦波の音声を書き出す"""
+    frequency = rng.uniform(100.0, 300.0)
+    samples = bytearray()
+    for n in range(num_samples):
+        t = n / 16_000
+        envelope = 0.5 + 0.5 * math.sin(2 * math.pi * 4.0 * t)
+        x = envelope * (0.3 * math.sin(2 * math.pi * frequency * t) + 0.05 * rng.uniform(-1.0, 1.0))
+        samples += struct.pack("<h", int(max(-1.0, min(1.0, x)) * 32767))
+    with wave.open(str(path), "wb") as f:
+        f.setnchannels(1)
+        f.setsampwidth(2)
+        f.setframerate(16_000)
+        f.writeframes(bytes(samples))
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("output_dir", type=Path)
+    parser.add_argument("--num_files", type=int, default=100)
+    parser.add_argument("--median_sec", type=float, default=5.0, help="音声長の中央値 (秒)")
+    parser.add_argument("--sigma", type=float, default=0.6, help="音声長の対数の標準偏差")
+    parser.add_argument("--min_sec", type=float, default=1.0)
+    parser.add_argument("--max_sec", type=float, default=60.0)
+    parser.add_argument("--phonemes_per_sec", type=float, default=12.0, help="1秒あたりの音素数")
+    parser.add_argument("--seed", type=int, default=0)
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    next_phonemes = load_transitions()
+    args.output_dir.mkdir(parents=True, exist_ok=True)
+
+    total_sec = 0.0
+    for i in range(args.num_files):
+        duration_sec = min(args.max_sec, max(args.min_sec, rng.lognormvariate(math.log(args.median_sec), args.sigma)))
+        num_samples = int(duration_sec * 16_000)
+        num_phonemes = max(3, int(duration_sec * args.phonemes_per_sec))
+        stem = args.output_dir / f"{i:06d}"
+        write_wav(stem.with_suffix(".wav"), num_samples, rng)
+        stem.with_suffix(".txt").write_text(" ".join(make_phonemes(next_phonemes, num_phonemes, rng)), encoding="utf-8")
+        total_sec += num_samples / 16_000
+
+    print(f"wrote {args.num_files} files ({total_sec:.1f} sec) to {args.output_dir}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,119 @@
+"""スループット計測用の小さな ONNX モデルを作るスクリプト
+
+学習済みモデルと同じ `input_waveform` (1 x sample_length) -> `transition_logprobs` (1 x seq_length x 556),
+`blank_logprobs` (1 x seq_length) のインタフェースを持つ。10ミリ秒 (160サンプル) ごとに1フレームを出力し、
+中間層は `--num_layers` 層の全結合 + ReLU で、重みは乱数で初期化する。
+`--token_conditioned` を付けると、`token_ids` (1 x num_tokens) を入力に取り、その列だけを gather した
+`transition_logprobs` (1 x seq_length x num_tokens) を出力するモデルになる。
+
+`onnx` パッケージが必要 (ネットワーク接続は不要)。
+"""
+import argparse
+import random
+from pathlib import Path
+
+import onnx
+from onnx import TensorProto, helper
+
+NUM_TRANSITION_VOCAB = 556
+HOP_LENGTH = 160
+
+
+def random_tensor(name: str, dims: list[int], scale: float, rng: random.Random) -> TensorProto:
+    size = 1
+    for d in dims:
+        size *= d
+    return helper.make_tensor(name, TensorProto.FLOAT, dims, [rng.gauss(0.0, scale) for _ in range(size)])
+
+
+def make_model(num_layers: int, hidden_size: int, token_conditioned: bool, seed: int) -> onnx.ModelProto:
+    rng = random.Random(seed)
+    num_outputs = NUM_TRANSITION_VOCAB + 1  # 最後の1つが blank
+    initializers = [
+        helper.make_tensor("unsqueeze_axes", TensorProto.INT64, [1], [1]),
+        helper.make_tensor("squeeze_axes", TensorProto.INT64, [1], [2]),
+        helper.make_tensor("token_axes", TensorProto.INT64, [1], [0]),
+        helper.make_tensor("transition_begin", TensorProto.INT64, [1], [0]),
+        helper.make_tensor("transition_end", TensorProto.INT64, [1], [NUM_TRANSITION_VOCAB]),
+        helper.make_tensor("blank_begin", TensorProto.INT64, [1], [NUM_TRANSITION_VOCAB]),
+        helper.make_tensor("blank_end", TensorProto.INT64, [1], [num_outputs]),
+        helper.make_tensor("last_axis", TensorProto.INT64, [1], [2]),
+        random_tensor("frame_weight", [hidden_size, 1, HOP_LENGTH], 1.0 / HOP_LENGTH**0.5, rng),
+        random_tensor("frame_bias", [hidden_size], 0.1, rng),
+    ]
+    nodes = [
+        # (1 x S) -> (1 x 1 x S) -> (1 x H x T) -> (1 x T x H)
+        helper.make_node("Unsqueeze", ["input_waveform", "unsqueeze_axes"], ["waveform_3d"]),
+        helper.make_node(
+            "Conv", ["waveform_3d", "frame_weight", "frame_bias"], ["frames"],
+            kernel_shape=[HOP_LENGTH], strides=[HOP_LENGTH],
+        ),
+        helper.make_node("Transpose", ["frames"], ["hidden_0"], perm=[0, 2, 1]),
+    ]
+    for i in range(num_layers):
+        initializers += [
+            random_tensor(f"layer_{i}_weight", [hidden_size, hidden_size], 1.0 / hidden_size**0.5, rng),
+            random_tensor(f"layer_{i}_bias", [hidden_size], 0.1, rng),
+        ]
+        nodes += [
+            helper.make_node("MatMul", [f"hidden_{i}", f"layer_{i}_weight"], [f"layer_{i}_matmul"]),
+            helper.make_node("Add", [f"layer_{i}_matmul", f"layer_{i}_bias"], [f"layer_{i}_add"]),
+            helper.make_node("Relu", [f"layer_{i}_add"], [f"hidden_{i + 1}"]),
+        ]
+
+    # blank が出やすいように blank のバイアスを大きくしておく
+    output_bias = [rng.gauss(0.0, 0.1) for _ in range(NUM_TRANSITION_VOCAB)] + [4.0]
+    initializers += [
+        random_tensor("output_weight", [hidden_size, num_outputs], 1.0 / hidden_size**0.5, rng),
+        helper.make_tensor("output_bias", TensorProto.FLOAT, [num_outputs], output_bias),
+    ]
+    nodes += [
+        helper.make_node("MatMul", [f"hidden_{num_layers}", "output_weight"], ["logits_matmul"]),
+        helper.make_node("Add", ["logits_matmul", "output_bias"], ["logits"]),
+        helper.make_node("LogSoftmax", ["logits"], ["logprobs"], axis=-1),
+        helper.make_node(
+            "Slice", ["logprobs", "transition_begin", "transition_end", "last_axis"],
+            ["all_transition_logprobs" if token_conditioned else "transition_logprobs"],
+        ),
+        helper.make_node("Slice", ["logprobs", "blank_begin", "blank_end", "last_axis"], ["blank_logprobs_3d"]),
+        helper.make_node("Squeeze", ["blank_logprobs_3d", "squeeze_axes"], ["blank_logprobs"]),
+    ]
+
+    inputs = [helper.make_tensor_value_info("input_waveform", TensorProto.FLOAT, [1, "sample_length"])]
+    transition_shape = [1, "seq_length", NUM_TRANSITION_VOCAB]
+    if token_conditioned:
+        inputs.append(helper.make_tensor_value_info("token_ids", TensorProto.INT64, [1, "num_tokens"]))
+        transition_shape = [1, "seq_length", "num_tokens"]
+        nodes += [
+            helper.make_node("Squeeze", ["token_ids", "token_axes"], ["token_ids_1d"]),
+            helper.make_node("Gather", ["all_transition_logprobs", "token_ids_1d"], ["transition_logprobs"], axis=2),
+        ]
+    outputs = [
+        helper.make_tensor_value_info("transition_logprobs", TensorProto.FLOAT, transition_shape),
+        helper.make_tensor_value_info("blank_logprobs", TensorProto.FLOAT, [1, "seq_length"]),
+    ]
+
+    graph = helper.make_graph(nodes, "synthetic_phoneme_transition_model", inputs, outputs, initializers)
+    model = helper.make_model(graph, opset_imports=[helper.make_opsetid("", 17)])
+    model.ir_version = 8  # onnxruntime 1.16 が読める IR バージョン
+    onnx.checker.check_model(model)
+    return model
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("output_path", type=Path)
+    parser.add_argument("--num_layers", type=int, default=2)
+    parser.add_argument("--hidden_size", type=int, default=256)
+    parser.add_argument("--token_conditioned", action="store_true")
+    parser.add_argument("--seed", type=int, default=0)
+    args = parser.parse_args()
+
+    model = make_model(args.num_layers, args.hidden_size, args.token_conditioned, args.seed)
+    args.output_path.parent.mkdir(parents=True, exist_ok=True)
+    onnx.save(model, str(args.output_path))
+    print(f"wrote {args.output_path}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,181 @@
+"""`domino` CLI と Python の `pydomino.Aligner` のエンドツーエンドのスループットを計測するスクリプト
+
+`make_corpus.py` で作ったコーパスと `make_model.py` で作ったモデル (あるいは学習済みモデル) を使い、
+ランナーごとに files/s、実時間係数 (RTF: 実行時間 / 音声長)、1ファイルあたりのレイテンシ (キューで待った時間を含む) の p50/p99、
+ピーク RSS と、ステージごとの平均所要時間を報告する。各ランナーは子プロセスで動かし、ピーク RSS は `wait4` で子プロセスごとに取る。
+
+`--baseline` に以前の `--output` を渡すと、files/s の低下か p99 の増加が `--threshold` を超えたときに
+終了コード1を返すので、新しいビルドを出す前のスループット回帰チェックに使える。
+"""
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+import wave
+from pathlib import Path
+
+def audio_duration_sec(corpus_dir: Path) -> dict[str, float]:
+    durations = {}
+    for wav_file in sorted(corpus_dir.glob("*.wav")):
+        with wave.open(str(wav_file), "rb") as f:
+            durations[wav_file.name] = f.getnframes() / f.getframerate()
+    return durations
+
+
+def run_child(command: list[str]) -> tuple[str, float, float]:
+    """子プロセスを実行して (標準出力, 経過秒数, ピーク RSS [MiB]) を返す"""
+    start = time.perf_counter()
+    process = subprocess.Popen(command, stdout=subprocess.PIPE, text=True)
+    stdout = process.stdout.read()
+    _, status, rusage = os.wait4(process.pid, 0)
+    elapsed_sec = time.perf_counter() - start
+    process.returncode = os.waitstatus_to_exitcode(status)
+    if process.returncode != 0:
+        raise RuntimeError(f"{command[0]} exited with {process.returncode}")
+    return stdout, elapsed_sec, rusage.ru_maxrss / 1024  # Linux の ru_maxrss は KiB
+
+
+def run_cli(domino: str, onnx_path: Path, corpus_dir: Path, min_frame: int) -> tuple[list[dict], float, float]:
+    with tempfile.TemporaryDirectory() as output_dir:
+        metrics_path = Path(output_dir) / "metrics.jsonl"
+        _, elapsed_sec, peak_rss_mib = run_child(
+            [
+                domino,
+                f"--input_path={corpus_dir}",
+                f"--output_path={output_dir}",
+                f"--onnx_path={onnx_path}",
+                f"--min_frame={min_frame}",
+                f"--metrics_path={metrics_path}",
+                "--quiet",
+            ]
+        )
+        num_outputs = len(list(Path(output_dir).glob("*.lab")))
+        records = [json.loads(line) for line in metrics_path.read_text(encoding="utf-8").splitlines() if line]
+    for record in records:
+        record["file"] = Path(record["file"]).name
+    if num_outputs != len(records):
+        raise RuntimeError(f"domino wrote {num_outputs} lab files for {len(records)} inputs")
+    return records, elapsed_sec, peak_rss_mib
+
+
+def run_python(onnx_path: Path, corpus_dir: Path, min_frame: int) -> tuple[list[dict], float, float]:
+    stdout, elapsed_sec, peak_rss_mib = run_child(
+        [sys.executable, __file__, "--worker", f"--onnx_path={onnx_path}", f"--min_frame={min_frame}", str(corpus_dir)]
+    )
+    return json.loads(stdout.splitlines()[-1]), elapsed_sec, peak_rss_mib
+
+
+def python_worker(onnx_path: Path, corpus_dir: Path, min_frame: int) -> None:
+    """子プロセス側: Aligner でコーパス全体をアラインメントし、ファイルごとの計測結果を JSON で出力する"""
+    import numpy as np
+    import pydomino
+
+    aligner = pydomino.Aligner(str(onnx_path))
+    records = []
+    for wav_file in sorted(corpus_dir.glob("*.wav")):
+        start = time.perf_counter()
+        with wave.open(str(wav_file), "rb") as f:
+            y = np.frombuffer(f.readframes(f.getnframes()), dtype=np.int16).astype(np.float32) / 32768
+        phonemes = wav_file.with_suffix(".txt").read_text(encoding="utf-8")
+        aligner.align(y, phonemes, min_frame)
+        record = aligner.stats()
+        record["timings_ms"]["total"] = (time.perf_counter() - start) * 1e3
+        record["file"] = wav_file.name
+        records.append(record)
+    print(json.dumps(records))
+
+
+def percentile(values: list[float], q: float) -> float:
+    """nearest-rank 法によるパーセンタイル"""
+    ordered = sorted(values)
+    rank = max(1, int(-(-q * len(ordered) // 100)))
+    return ordered[rank - 1]
+
+
+def summarize(records: list[dict], elapsed_sec: float, peak_rss_mib: float, durations: dict[str, float]):
+    audio_sec = sum(durations[record["file"]] for record in records)
+    # ディレクトリの一括処理では total がキューで待った時間を含まないので、レイテンシには pipeline_latency を使う
+    values = [record["timings_ms"].get("pipeline_latency", record["timings_ms"]["total"]) for record in records]
+    stage_ms: dict[str, float] = {}
+    for record in records:
+        for stage, elapsed_ms in record["timings_ms"].items():
+            stage_ms[stage] = stage_ms.get(stage, 0.0) + elapsed_ms / len(records)
+    return {
+        "files": len(values),
+        "audio_sec": audio_sec,
+        "wall_sec": elapsed_sec,
+        "files_per_sec": len(values) / elapsed_sec,
+        "rtf": elapsed_sec / audio_sec,
+        "p50_ms": percentile(values, 50),
+        "p99_ms": percentile(values, 99),
+        "peak_rss_mib": peak_rss_mib,
+        "mean_stage_ms": stage_ms,
+    }
+
+
+def check_regressions(report: dict, baseline: dict, threshold: float) -> list[str]:
+    regressions = []
+    for runner, result in report.items():
+        if runner not in baseline:
+            continue
+        base = baseline[runner]
+        if result["files_per_sec"] < base["files_per_sec"] * (1.0 - threshold):
+            regressions.append(f"{runner}: files/s {base['files_per_sec']:.2f} -> {result['files_per_sec']:.2f}")
+        if result["p99_ms"] > base["p99_ms"] * (1.0 + threshold):
+            regressions.append(f"{runner}: p99 {base['p99_ms']:.1f} ms -> {result['p99_ms']:.1f} ms")
+    return regressions
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("corpus_dir", type=Path)
+    parser.add_argument("--onnx_path", type=Path, required=True)
+    parser.add_argument("--domino", default="domino", help="domino CLI の実行ファイルパス")
+    parser.add_argument("--runners", default="cli,python", help="カンマ区切りのランナー (cli, python)")
+    parser.add_argument("--min_frame", type=int, default=3)
+    parser.add_argument("--output", type=Path, help="結果を書き出す JSON ファイル")
+    parser.add_argument("--baseline", type=Path, help="比較対象の以前の --output")
+    parser.add_argument("--threshold", type=float, default=0.1, help="回帰とみなす相対的な変化。デフォルトは 0.1")
+    parser.add_argument("--worker", action="store_true", help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.worker:
+        python_worker(args.onnx_path, args.corpus_dir, args.min_frame)
+        return 0
+
+    durations = audio_duration_sec(args.corpus_dir)
+    report = {}
+    for runner in args.runners.split(","):
+        if runner == "cli":
+            result = run_cli(args.domino, args.onnx_path, args.corpus_dir, args.min_frame)
+        elif runner == "python":
+            result = run_python(args.onnx_path, args.corpus_dir, args.min_frame)
+        else:
+            raise ValueError(f"unknown runner: {runner}")
+        report[runner] = summarize(*result, durations)
+
+    print(f"{'runner':<8} {'files':>6} {'files/s':>9} {'RTF':>8} {'p50[ms]':>9} {'p99[ms]':>9} {'RSS[MiB]':>9}")
+    for runner, r in report.items():
+        print(
+            f"{runner:<8} {r['files']:>6} {r['files_per_sec']:>9.2f} {r['rtf']:>8.4f} "
+            f"{r['p50_ms']:>9.1f} {r['p99_ms']:>9.1f} {r['peak_rss_mib']:>9.1f}"
+        )
+        print("         " + ", ".join(f"{stage}: {ms:.2f} ms" for stage, ms in r["mean_stage_ms"].items()))
+
+    if args.output:
+        args.output.write_text(json.dumps(report, indent=2), encoding="utf-8")
+
+    if args.baseline:
+        regressions = check_regressions(report, json.loads(args.baseline.read_text(encoding="utf-8")), args.threshold)
+        for regression in regressions:
+            print(f"REGRESSION {regression}")
+        if regressions:
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -3,13 +3,29 @@ from pydomino.pydomino_cpp import Aligner_cpp
 
 
 class Aligner(Aligner_cpp):
-    def __init__(self, onnxfile: str):
+    def __init__(
+        self,
+        onnxfile: str,
+        profile_file_prefix: str = "",
+        viterbi_num_threads: int = 1,
+        intra_op_num_threads: int = 0,
+        graph_optimization: str = "all",
+        fork_safe: bool = False,
+    ):
         """コンストラクタ。ここで `onnxfile` で指定したONNXファイルを読み込む
 
         Args:
             onnxfile (str): 読み込ませたいONNXファイルパス
+            profile_file_prefix (str): 空でなければ ONNX Runtime のプロファイラを有効にし、このプレフィックスのファイル名で結果を書き出す
+            viterbi_num_threads (int): 長い音素列の Viterbi の前向き計算に使うスレッド数。デフォルトは 1 (並列化しない) で、0 のときはハードウェアのスレッド数
+            intra_op_num_threads (int): ONNX Runtime の推論に使うスレッド数。0 のときは ONNX Runtime のデフォルト
+            graph_optimization (str): ONNX Runtime のグラフ最適化レベル。`disable`, `basic`, `extended`, `all` のいずれか。int8 量子化モデルでは `extended` 以上にする
+            fork_safe (bool): True のとき、モデルファイルをメモリにマップして読み込み、`multiprocessing` などで fork した子プロセスでも使えるようにする。
+                子プロセスでは最初の `align` で同じページからセッションを作り直す。ORT 形式 (`.ort`) のモデルなら重みも子プロセス間で共有される
         """
-        super().__init__(onnxfile)
+        super().__init__(
+            onnxfile, profile_file_prefix, viterbi_num_threads, intra_op_num_threads, graph_optimization, fork_safe
+        )
 
     def __del__(self):
         super().release()
@@ -29,6 +45,36 @@ class Aligner(Aligner_cpp):
         """
         return super().align(waveform_mono_16kHz, phonemes, min_aligned_timeframe)
 
+    def align_with_confidence(self, waveform_mono_16kHz: np.ndarray, phonemes: str, min_aligned_timeframe: int) -> dict:
+        """`align` と同じアラインメントに加えて、音素ごとの信頼度と発話全体のスコアを返す関数
+
+        Viterbi の格子の後ろ向き計算を追加で行うだけなので、`align` とほぼ同じ時間で終わる
+
+        Args:
+            waveform_mono_16kHz (np.ndarray): 16kHzのモノラル音声信号。サンプリング値は (-1, 1) に正規化された32bit浮動小数点
+            phonemes (str): 半角スペース区切りの音素列
+            min_aligned_timeframe (int): `align` と同じ
+
+        Returns:
+            dict: `alignment` に `(開始秒数, 終了秒数, 音素, 信頼度, 平均対数尤度)` のタプル列、`confidence` に発話全体の信頼度 (音素の信頼度の平均)、
+            `logprob` に発話全体の1フレームあたりの平均対数尤度、`total_logprob` にすべての経路についての1フレームあたりの対数尤度が入った辞書。
+            フレームが割り当てられなかった音素の平均対数尤度は NaN。音素の信頼度 (0〜1) は、音素の両端の境界が求めた時刻の前後20ミリ秒以内にある事後確率の小さいほう
+        """
+        return super().align_with_confidence(waveform_mono_16kHz, phonemes, min_aligned_timeframe)
+
+    def stats(self) -> dict:
+        """直前の `align` の計測結果を返す関数
+
+        Returns:
+            dict: `timings_ms` にステージ (`read_phonemes`, `ort_run`, `viterbi_init`, `viterbi_forward`, `viterbi_backtrace`) ごとの所要時間 (ミリ秒)、
+            `counts` にサンプル数・時間フレーム数・トークン数・確保したバイト数が入った辞書
+        """
+        return super().stats()
+
+    def end_profiling(self) -> str:
+        """ONNX Runtime のプロファイラを止めて、書き出したファイルのパスを返す関数。プロファイラが無効のときは空文字列を返す"""
+        return super().end_profiling()
+
     def release(self):
         """内部で読み込んだ ONNX ファイルのメモリを開放する関数。デストラクタでこの関数を呼び出す。"""
         super().release()
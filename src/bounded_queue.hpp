@@ -0,0 +1,178 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+namespace domino {
+/**
+ * @brief 容量固定のロックフリーな MPMC キュー (Dmitry Vyukov の bounded MPMC queue)。
+ * 各セルのシーケンス番号で、書き込み済みか読み出し済みかを判別する。満杯・空のときは待たずに false を返す
+ *
+ * @tparam T デフォルト構築とムーブ代入ができる型
+ */
+template <typename T>
+class BoundedQueue {
+ public:
+  // capacity は 2 のべき乗に切り上げる
+  explicit BoundedQueue(std::size_t const capacity)
+      : capacity_(round_up_to_power_of_2(capacity)), mask_(capacity_ - 1), cells_(new Cell[capacity_]) {
+    for (std::size_t i = 0; i < capacity_; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  BoundedQueue(BoundedQueue const&) = delete;
+  BoundedQueue& operator=(BoundedQueue const&) = delete;
+
+  std::size_t capacity() const { return capacity_; }
+
+  // 入っている要素数の目安。他のスレッドが同時に push/pop していると正確ではない
+  std::size_t size_approx() const {
+    std::size_t const enqueue_pos = enqueue_pos_.load(std::memory_order_relaxed);
+    std::size_t const dequeue_pos = dequeue_pos_.load(std::memory_order_relaxed);
+    return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+  }
+
+  bool try_push(T& value) {
+    std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell& cell = cells_[pos & mask_];
+      std::size_t const sequence = cell.sequence.load(std::memory_order_acquire);
+      std::intptr_t const diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.value = std::move(value);
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // 満杯
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool try_pop(T& value) {
+    std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell& cell = cells_[pos & mask_];
+      std::size_t const sequence = cell.sequence.load(std::memory_order_acquire);
+      std::intptr_t const diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          value = std::move(cell.value);
+          cell.sequence.store(pos + capacity_, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // 空
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+ private:
+  struct Cell {
+    std::atomic<std::size_t> sequence;
+    T value;
+  };
+
+  static std::size_t round_up_to_power_of_2(std::size_t const n) {
+    std::size_t capacity = 2;
+    while (capacity < n) {
+      capacity *= 2;
+    }
+    return capacity;
+  }
+
+  std::size_t const capacity_;
+  std::size_t const mask_;
+  std::unique_ptr<Cell[]> const cells_;
+  // push 側と pop 側が同じキャッシュラインを奪い合わないように分ける
+  alignas(64) std::atomic<std::size_t> enqueue_pos_{0};
+  alignas(64) std::atomic<std::size_t> dequeue_pos_{0};
+};
+
+/**
+ * @brief パイプラインのステージ間をつなぐ BoundedQueue。満杯・空のときは少しずつ間隔を空けながら待ち、
+ * 待った時間を記録する。すべての送り手が close すると、受け手の pop は空になった時点で false を返す
+ */
+template <typename T>
+class Channel {
+ public:
+  Channel(std::size_t const capacity, int const num_producers) : queue_(capacity), num_open_producers_(num_producers) {}
+
+  // 満杯なら空きができるまで待つ
+  void push(T value) {
+    auto const start = std::chrono::steady_clock::now();
+    for (int attempt = 0; !queue_.try_push(value); ++attempt) {
+      backoff(attempt);
+    }
+    push_wait_ns_.fetch_add(elapsed_ns(start), std::memory_order_relaxed);
+    depth_sum_.fetch_add(queue_.size_approx(), std::memory_order_relaxed);
+    num_pushed_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // 要素が来るまで待つ。すべての送り手が close していて空なら false
+  bool pop(T& value) {
+    auto const start = std::chrono::steady_clock::now();
+    for (int attempt = 0;; ++attempt) {
+      if (queue_.try_pop(value)) {
+        pop_wait_ns_.fetch_add(elapsed_ns(start), std::memory_order_relaxed);
+        return true;
+      }
+      // close の後に push されたものを取りこぼさないよう、close を確認してからもう一度取り出す
+      if (num_open_producers_.load(std::memory_order_acquire) == 0) {
+        if (queue_.try_pop(value)) {
+          pop_wait_ns_.fetch_add(elapsed_ns(start), std::memory_order_relaxed);
+          return true;
+        }
+        return false;
+      }
+      backoff(attempt);
+    }
+  }
+
+  // 送り手が1つ終わったことを知らせる
+  void close() { num_open_producers_.fetch_sub(1, std::memory_order_acq_rel); }
+
+  std::size_t capacity() const { return queue_.capacity(); }
+  // 送り手が満杯のキューに空きができるのを待った時間の合計
+  double push_wait_ms() const { return push_wait_ns_.load() / 1e6; }
+  // 受け手が空のキューに要素が来るのを待った時間の合計
+  double pop_wait_ms() const { return pop_wait_ns_.load() / 1e6; }
+  // push した直後のキューの要素数の平均
+  double mean_depth() const {
+    std::size_t const num_pushed = num_pushed_.load();
+    return num_pushed ? static_cast<double>(depth_sum_.load()) / num_pushed : 0.0;
+  }
+
+ private:
+  static std::int64_t elapsed_ns(std::chrono::steady_clock::time_point const start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  // しばらくは yield で待ち、長引いたらスリープして他のステージに CPU を譲る
+  static void backoff(int const attempt) {
+    if (attempt < 64) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+  BoundedQueue<T> queue_;
+  std::atomic<int> num_open_producers_;
+  std::atomic<std::int64_t> push_wait_ns_{0};
+  std::atomic<std::int64_t> pop_wait_ns_{0};
+  std::atomic<std::size_t> depth_sum_{0};
+  std::atomic<std::size_t> num_pushed_{0};
+};
+}  // namespace domino
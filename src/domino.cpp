@@ -1,10 +1,13 @@
 ﻿/* Pythonライブラリとコマンドコンソール両方のインタフェースを書く場所 */
 #include "domino.hpp"
 
+#include <algorithm>
 #include <array>
 #include <fstream>
 #include <iostream>
+#include <numeric>
 #include <sstream>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 #include <vector>
@@ -12,16 +15,92 @@
 #include "phoneme_transition.hpp"
 #include "viterbi.hpp"
 
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
 namespace domino {
-Aligner::Aligner(std::string const &path, int const N)
-    : env_(),
-      session_options_(),
-      session_(env_, std::filesystem::path(path).c_str(), session_options_),
+namespace {
+bool has_input(Ort::Session const &session, char const *name) {
+  Ort::AllocatorWithDefaultOptions allocator;
+  for (std::size_t i = 0; i < session.GetInputCount(); ++i) {
+    if (std::string(session.GetInputNameAllocated(i, allocator).get()) == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+long current_process_id() {
+#ifdef _WIN32
+  return _getpid();
+#else
+  return getpid();
+#endif
+}
+
+Ort::SessionOptions make_session_options(std::string const &path, AlignerOptions const &options) {
+  Ort::SessionOptions session_options;
+  session_options.SetGraphOptimizationLevel(options.graph_optimization_level);
+  if (options.intra_op_num_threads > 0) {
+    session_options.SetIntraOpNumThreads(options.intra_op_num_threads);
+  }
+  if (!options.optimized_model_path.empty()) {
+    session_options.SetOptimizedModelFilePath(std::filesystem::path(options.optimized_model_path).c_str());
+  }
+  if (!options.profile_file_prefix.empty()) {
+    session_options.EnableProfiling(std::filesystem::path(options.profile_file_prefix).c_str());
+  }
+  if (options.fork_safe && std::filesystem::path(path).extension() == ".ort") {
+    // 重みをセッションにコピーせず、マップしたモデルのページを直接参照させる。
+    // 事前パックした重みはプロセスごとの領域に作られてしまうので無効にする
+    session_options.AddConfigEntry("session.use_ort_model_bytes_directly", "1");
+    session_options.AddConfigEntry("session.use_ort_model_bytes_for_initializers", "1");
+    session_options.AddConfigEntry("session.disable_prepacking", "1");
+  }
+  return session_options;
+}
+
+Ort::Session make_session(Ort::Env const &env, std::string const &path, MappedFile const &model_file,
+                          Ort::SessionOptions const &session_options) {
+  if (model_file.empty()) {
+    return Ort::Session(env, std::filesystem::path(path).c_str(), session_options);
+  }
+  return Ort::Session(env, model_file.data(), model_file.size(), session_options);
+}
+}  // namespace
+
+GraphOptimizationLevel parse_graph_optimization_level(std::string const &level) {
+  if (level == "disable") {
+    return ORT_DISABLE_ALL;
+  } else if (level == "basic") {
+    return ORT_ENABLE_BASIC;
+  } else if (level == "extended") {
+    return ORT_ENABLE_EXTENDED;
+  } else if (level == "all") {
+    return ORT_ENABLE_ALL;
+  }
+  throw std::invalid_argument("graph optimization level must be one of disable, basic, extended and all: " + level);
+}
+
+Aligner::Aligner(std::string const &path, int const N, AlignerOptions const &options)
+    : path_(path),
+      options_(options),
+      env_(),
+      session_options_(make_session_options(path, options)),
+      model_file_(options.fork_safe ? MappedFile(path) : MappedFile()),
+      session_(make_session(env_, path, model_file_, session_options_)),
       memory_info_(Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU)),
       run_options_(),
-      N_(N) {
-  std::cout << "path: " << path << std::endl;
-}
+      takes_token_ids_(has_input(session_, "token_ids")),
+      profiling_enabled_(!options.profile_file_prefix.empty()),
+      viterbi_num_threads_(options.viterbi_num_threads > 0
+                               ? options.viterbi_num_threads
+                               : std::max(1, static_cast<int>(std::thread::hardware_concurrency()))),
+      N_(N),
+      session_process_id_(current_process_id()) {}
 
 Aligner::~Aligner() { this->release(); }
 
@@ -32,39 +111,150 @@ void Aligner::release() {
   env_.release();
 }
 
+void Aligner::ensure_session() {
+  long const process_id = current_process_id();
+  if (session_process_id_.load(std::memory_order_acquire) == process_id) {
+    return;
+  }
+  std::lock_guard<std::mutex> const lock(session_mutex_);
+  if (session_process_id_.load(std::memory_order_relaxed) == process_id) {
+    return;
+  }
+  if (!options_.fork_safe) {
+    throw std::runtime_error("Aligner was created in another process; construct it with fork_safe to use it after fork");
+  }
+  // 受け継いだセッションのスレッドプールは子プロセスには存在しないので、破棄せずに手放す。
+  // 最適化済みモデルは親プロセスが書き出しているので、子プロセスでは書き出さない
+  session_.release();
+  AlignerOptions child_options = options_;
+  child_options.optimized_model_path = "";
+  session_options_ = make_session_options(path_, child_options);
+  session_ = make_session(env_, path_, model_file_, session_options_);
+  session_process_id_.store(process_id, std::memory_order_release);
+}
+
+std::string Aligner::end_profiling() {
+  if (!profiling_enabled_ || session_process_id_.load(std::memory_order_acquire) != current_process_id()) {
+    return "";
+  }
+  Ort::AllocatorWithDefaultOptions allocator;
+  return session_.EndProfilingAllocated(allocator).get();
+}
+
 std::vector<std::tuple<double, double, std::string>> Aligner::align_phonemes(Eigen::Ref<Eigen::VectorXf> const wav_data,
-                                                                             std::string const &phonemes, int N) {
-  return this->align(wav_data.data(), wav_data.size(), Aligner::read_phonemes(phonemes), N);
+                                                                             std::string const &phonemes, int N,
+                                                                             AlignmentScores *scores) {
+  last_metrics_.clear();
+  std::vector<int> token_ids;
+  {
+    ScopedTimer const timer(&last_metrics_, "read_phonemes");
+    token_ids = Aligner::read_phonemes(phonemes);
+  }
+  return this->align(wav_data.data(), wav_data.size(), token_ids, N, &last_metrics_, scores);
 }
 
 std::vector<std::tuple<double, double, std::string>> Aligner::align(float const *wav_data,
                                                                     std::size_t const wav_data_size,
                                                                     std::vector<int> const &token_ids,
-                                                                    int min_timeframe_per_1_phoneme) {
-  constexpr char const *const input_names[] = {"input_waveform"};
+                                                                    int min_timeframe_per_1_phoneme,
+                                                                    Metrics *metrics, AlignmentScores *scores) {
+  return decode(infer(wav_data, wav_data_size, token_ids, metrics), min_timeframe_per_1_phoneme, metrics, scores);
+}
+
+Emissions Aligner::infer(float const *wav_data, std::size_t const wav_data_size, std::vector<int> const &token_ids,
+                         Metrics *metrics) {
+  ensure_session();
+
+  constexpr char const *const input_names[] = {"input_waveform", "token_ids"};
   constexpr char const *const output_names[] = {"transition_logprobs", "blank_logprobs"};
   // NOTE: C++17以上が必須
 
   std::array<std::int64_t, 2> const wav_data_shape = {1, static_cast<std::int64_t>(wav_data_size)};
-  Ort::Value inputs[] = {
-      Ort::Value::CreateTensor(memory_info_, const_cast<float *>(wav_data), wav_data_size, wav_data_shape.data(),
-                               wav_data_shape.size()),
-  };
-  std::vector<Ort::Value> const outputs =
-      session_.Run(run_options_, input_names, inputs, std::size(input_names), output_names, std::size(output_names));
-  float const *const transition_logprobs = outputs[0].GetTensorData<float>();
-  auto const transition_logprobs_shape = outputs[0].GetTensorTypeAndShapeInfo().GetShape();
-  float const *const blank_logprobs = outputs[1].GetTensorData<float>();
-  auto const blank_logprobs_shape = outputs[1].GetTensorTypeAndShapeInfo().GetShape();
-
-  int const num_timeframe = transition_logprobs_shape[1];
-  if (min_timeframe_per_1_phoneme * (token_ids.size() - 1) + 1 > num_timeframe) {
-    std::cout << "[warn] timeframe / phoneme is too large for alignment. " << std::endl;
+  std::vector<std::int64_t> token_ids_data(token_ids.begin(), token_ids.end());
+  std::array<std::int64_t, 2> const token_ids_shape = {1, static_cast<std::int64_t>(token_ids_data.size())};
+  std::vector<Ort::Value> inputs;
+  inputs.push_back(Ort::Value::CreateTensor(memory_info_, const_cast<float *>(wav_data), wav_data_size,
+                                            wav_data_shape.data(), wav_data_shape.size()));
+  if (takes_token_ids_) {
+    // token_ids を入力に取るモデルは、入力トークン列の列だけを gather した (1 x T x K) の遷移確率を出力する
+    inputs.push_back(Ort::Value::CreateTensor<std::int64_t>(memory_info_, token_ids_data.data(),
+                                                            token_ids_data.size(), token_ids_shape.data(),
+                                                            token_ids_shape.size()));
+  }
+  Emissions emissions;
+  {
+    ScopedTimer const timer(metrics, "ort_run");
+    emissions.outputs = session_.Run(run_options_, input_names, inputs.data(), inputs.size(), output_names,
+                                     std::size(output_names));
+  }
+  emissions.token_ids = token_ids;
+  emissions.num_samples = wav_data_size;
+  return emissions;
+}
+
+std::vector<std::tuple<double, double, std::string>> Aligner::decode(Emissions const &emissions,
+                                                                     int min_timeframe_per_1_phoneme,
+                                                                     Metrics *metrics, AlignmentScores *scores) {
+  std::vector<int> const &token_ids = emissions.token_ids;
+  std::size_t const wav_data_size = emissions.num_samples;
+  float const *const transition_logprobs = emissions.outputs[0].GetTensorData<float>();
+  auto const transition_logprobs_shape = emissions.outputs[0].GetTensorTypeAndShapeInfo().GetShape();
+  float const *const blank_logprobs = emissions.outputs[1].GetTensorData<float>();
+  // (1 x T x V) と (T x V) のどちらの shape でも受け付ける
+  int const num_timeframe = transition_logprobs_shape[transition_logprobs_shape.size() - 2];
+  int const num_transition_vocab = transition_logprobs_shape[transition_logprobs_shape.size() - 1];
+
+  // gather 済みの出力では、i番目の入力トークンの遷移確率は i列目にある
+  std::vector<int> column_ids;
+  if (takes_token_ids_) {
+    if (num_transition_vocab != token_ids.size()) {
+      throw std::runtime_error("transition_logprobs must have " + std::to_string(token_ids.size()) +
+                               " columns, but got " + std::to_string(num_transition_vocab));
+    }
+    column_ids.resize(token_ids.size());
+    std::iota(column_ids.begin(), column_ids.end(), 0);
+  }
+  std::vector<int> const &viterbi_token_ids = takes_token_ids_ ? column_ids : token_ids;
+
+  if (metrics) {
+    metrics->set_count("samples", wav_data_size);
+    metrics->set_count("timeframes", num_timeframe);
+    metrics->set_count("tokens", token_ids.size());
+    metrics->set_count("ort_output_bytes",
+                       static_cast<std::int64_t>(num_timeframe) * (num_transition_vocab + 1) * sizeof(float));
+  }
+
+  bool const min_frame_clamped = min_timeframe_per_1_phoneme * (token_ids.size() - 1) + 1 > num_timeframe;
+  if (min_frame_clamped) {
+    int const requested_min_timeframe = min_timeframe_per_1_phoneme;
     min_timeframe_per_1_phoneme = (num_timeframe - 1) / (token_ids.size() - 1);
+    // 複数のスレッドから decode されても行が混ざらないよう、1行を組み立ててから標準エラー出力に1回で書く
+    std::string const message = "[warn] timeframe / phoneme is too large for alignment. min_frame " +
+                                std::to_string(requested_min_timeframe) + " -> " +
+                                std::to_string(min_timeframe_per_1_phoneme) + "\n";
+    std::cerr << message << std::flush;
+  }
+  if (metrics) {
+    metrics->set_count("min_frame_clamped", min_frame_clamped ? 1 : 0);
   }
   std::vector<int> transition_timeframes(token_ids.size(), 0);
-  solve_viterbi(transition_logprobs_shape[1], transition_logprobs_shape[2], transition_logprobs, blank_logprobs,
-                min_timeframe_per_1_phoneme, token_ids, transition_timeframes);
+  ViterbiScores viterbi_scores;
+  solve_viterbi(num_timeframe, num_transition_vocab, transition_logprobs, blank_logprobs, min_timeframe_per_1_phoneme,
+                viterbi_token_ids, transition_timeframes, viterbi_num_threads_, metrics,
+                scores ? &viterbi_scores : nullptr);
+  if (scores) {
+    // 音素の信頼度は両端の境界の信頼度の小さいほう。発話の先頭と末尾は境界ではないので 1 とみなす
+    scores->confidences.assign(token_ids.size() + 1, 1.0f);
+    for (std::size_t i = 0; i < token_ids.size(); ++i) {
+      scores->confidences[i] = std::min(scores->confidences[i], viterbi_scores.boundary_confidences[i]);
+      scores->confidences[i + 1] = std::min(scores->confidences[i + 1], viterbi_scores.boundary_confidences[i]);
+    }
+    scores->logprobs = std::move(viterbi_scores.segment_logprobs);
+    scores->utterance_confidence =
+        std::accumulate(scores->confidences.begin(), scores->confidences.end(), 0.0f) / scores->confidences.size();
+    scores->utterance_logprob = viterbi_scores.path_logprob / num_timeframe;
+    scores->utterance_total_logprob = viterbi_scores.total_logprob / num_timeframe;
+  }
 
   // 音素遷移トークンの予測発生時刻を音素ラベル表現の形に変換する
   std::vector<std::tuple<double, double, std::string>> alignment;
@@ -3,38 +3,125 @@
 #include <onnxruntime_cxx_api.h>
 
 #include <Eigen/Core>
+#include <atomic>
 #include <filesystem>
+#include <mutex>
 #include <string>
 #include <tuple>
 #include <vector>
 
+#include "mapped_file.hpp"
+#include "metrics.hpp"
 #include "phoneme_transition.hpp"
 
 namespace domino {
+struct AlignerOptions {
+  // 空でなければ ONNX Runtime のプロファイラを有効にし、このプレフィックスのファイル名で JSON を書き出す
+  std::string profile_file_prefix = "";
+  // 長い音素列の Viterbi の前向き計算に使うスレッド数。0 のときはハードウェアのスレッド数。
+  // 並列版は align のたびにスレッドを起こすので、多数の Aligner やスレッドから呼ぶときは 1 のままにする
+  int viterbi_num_threads = 1;
+  // ONNX Runtime の推論に使うスレッド数。0 のときは ONNX Runtime のデフォルト
+  int intra_op_num_threads = 0;
+  // int8 量子化モデルは、DynamicQuantizeLinear + MatMulInteger などを融合する ORT_ENABLE_EXTENDED 以上で速くなる
+  GraphOptimizationLevel graph_optimization_level = ORT_ENABLE_ALL;
+  // 空でなければ、最適化 (量子化演算の融合など) を済ませたモデルをこのパスに書き出す。次回からはこちらを読み込めばよい
+  std::string optimized_model_path = "";
+  // true のとき、モデルファイルを読み込み専用でメモリにマップし、そこからセッションを作る。fork した子プロセスでは、
+  // 最初の align で同じページからセッションとスレッドプールを作り直す。ORT 形式 (.ort) のモデルは重みもマップした
+  // ページを直接参照するので、子プロセスをいくつ作ってもモデルのメモリは1つ分で済む
+  bool fork_safe = false;
+};
+
+// アラインメント結果の音素ごとの信頼度と、発話全体のスコア。前向き後ろ向きアルゴリズムで求める
+struct AlignmentScores {
+  // 音素ごとの信頼度 (0〜1)。音素の両端の境界が、求めた時刻の前後 20 ミリ秒以内にある事後確率の小さいほう
+  std::vector<float> confidences;
+  // 音素ごとの、割り当てたフレームの1フレームあたりの平均対数尤度。フレームが割り当てられなかった音素は NaN
+  std::vector<float> logprobs;
+  // 発話全体の信頼度。音素の信頼度の平均
+  float utterance_confidence = 0.0f;
+  // 発話全体の1フレームあたりの平均対数尤度
+  float utterance_logprob = 0.0f;
+  // すべての経路についての発話全体の対数尤度を、フレーム数で割ったもの。経路を1つに決めないぶん、
+  // utterance_logprob よりも書き起こしと音声の食い違いに対して安定している
+  float utterance_total_logprob = 0.0f;
+};
+
+// ORT の推論結果。推論と Viterbi を別々のスレッドで実行するときに、Aligner::infer から Aligner::decode へ渡す
+struct Emissions {
+  // transition_logprobs と blank_logprobs
+  std::vector<Ort::Value> outputs;
+  std::vector<int> token_ids;
+  std::size_t num_samples = 0;
+};
+
+// "disable", "basic", "extended", "all" のいずれかを GraphOptimizationLevel に変換する
+GraphOptimizationLevel parse_graph_optimization_level(std::string const& level);
+
 class Aligner {
  public:
-  Aligner(std::string const& path, int const N = 3);
+  Aligner(std::string const& path, int const N = 3, AlignerOptions const& options = AlignerOptions());
   ~Aligner();
 
   void release();
 
+  // プロファイラを止めて、書き出したファイルのパスを返す。プロファイラが無効のときは空文字列
+  std::string end_profiling();
+
   // std::vector<std::tuple<double, double, std::string>>: labデータの構造
   std::vector<std::tuple<double, double, std::string>> align_phonemes(Eigen::Ref<Eigen::VectorXf> const wav,
-                                                                      std::string const& phonemes, int N = 0);
+                                                                      std::string const& phonemes, int N = 0,
+                                                                      AlignmentScores* scores = nullptr);
+  // metrics が nullptr でなければ、ORT の推論と Viterbi の各ステージの所要時間やフレーム数などを記録する
+  // scores が nullptr でなければ、後ろ向き計算も行って音素ごとの信頼度を求める
   std::vector<std::tuple<double, double, std::string>> align(float const* wav_data, std::size_t const wav_data_size,
-                                                             std::vector<int> const& phonemes_index, int N = 0);
+                                                             std::vector<int> const& phonemes_index, int N = 0,
+                                                             Metrics* metrics = nullptr,
+                                                             AlignmentScores* scores = nullptr);
+
+  // align の前半。ORT で推論した結果を返す。wav_data は推論が終わるまで有効であればよい
+  Emissions infer(float const* wav_data, std::size_t const wav_data_size, std::vector<int> const& phonemes_index,
+                  Metrics* metrics = nullptr);
+  // align の後半。infer の結果から Viterbi でアラインメントを求める。別のスレッドの infer と並行して呼べる
+  std::vector<std::tuple<double, double, std::string>> decode(Emissions const& emissions, int N = 0,
+                                                              Metrics* metrics = nullptr,
+                                                              AlignmentScores* scores = nullptr);
 
   std::vector<int> read_phonemes(std::filesystem::path const& file);
   std::vector<int> read_phonemes(std::string const& s);
 
+  // モデルが token_ids を入力に取り、gather 済みの遷移確率を出力するかどうか
+  bool takes_token_ids() const { return takes_token_ids_; }
+
+  // 直前の align_phonemes の計測結果
+  Metrics const& last_metrics() const { return last_metrics_; }
+
  private:
+  // fork した子プロセスで初めて呼ばれたときに、マップ済みのモデルからセッションを作り直す
+  void ensure_session();
+
+  std::string const path_;
+  AlignerOptions const options_;
+
   Ort::Env env_;
   Ort::SessionOptions session_options_;
+  MappedFile const model_file_;
   Ort::Session session_;
   Ort::MemoryInfo memory_info_;
   Ort::RunOptions run_options_;
 
+  // true: モデルが `token_ids` 入力を受け取り、入力トークン列の列だけを gather した (T x K) の遷移確率を出力する
+  bool const takes_token_ids_;
+
+  bool const profiling_enabled_;
+  int const viterbi_num_threads_;
+
   int const N_;
+  // session_ を作ったプロセスの ID。fork した子プロセスでは getpid() と一致しない
+  std::atomic<long> session_process_id_;
+  std::mutex session_mutex_;
   PhonemeTransitionTokenizer tokenizer = PhonemeTransitionTokenizer();
+  Metrics last_metrics_;
 };
 }  // namespace domino
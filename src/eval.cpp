@@ -0,0 +1,283 @@
+﻿/* 2つのモデル (例えば fp32 と int8 量子化) のアラインメント結果と速度を比較するツール */
+#include <argparse/argparse.hpp>
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "domino.hpp"
+#include "load_wav.hpp"
+#include "metrics.hpp"
+
+namespace {
+using Alignment = std::vector<std::tuple<double, double, std::string>>;
+
+/**
+ * @brief 音素ごとの境界のずれ (ミリ秒) の集計
+ */
+struct DeviationStats {
+  std::size_t count = 0;
+  double sum_abs_ms = 0.0;
+  double max_abs_ms = 0.0;
+  std::size_t within_10ms = 0;
+  std::size_t within_20ms = 0;
+  std::size_t within_50ms = 0;
+
+  void add(double const deviation_ms) {
+    double const abs_ms = std::abs(deviation_ms);
+    ++count;
+    sum_abs_ms += abs_ms;
+    max_abs_ms = std::max(max_abs_ms, abs_ms);
+    within_10ms += abs_ms <= 10.0;
+    within_20ms += abs_ms <= 20.0;
+    within_50ms += abs_ms <= 50.0;
+  }
+
+  double mean_abs_ms() const { return count ? sum_abs_ms / count : 0.0; }
+};
+
+/**
+ * @brief 比較対象ごとに、全体と音素ごとのずれを集計する
+ */
+struct DeviationTable {
+  DeviationStats total;
+  std::map<std::string, DeviationStats> per_phoneme;
+
+  // 各音素の終了時刻 (最後の音素は音声の終端なので除く) のずれを加える。音素数が異なるときは false
+  bool add(Alignment const &expected, Alignment const &actual) {
+    if (expected.size() != actual.size()) {
+      return false;
+    }
+    for (std::size_t i = 0; i + 1 < expected.size(); ++i) {
+      double const deviation_ms = (std::get<1>(actual[i]) - std::get<1>(expected[i])) * 1000.0;
+      total.add(deviation_ms);
+      per_phoneme[std::get<2>(expected[i])].add(deviation_ms);
+    }
+    return true;
+  }
+};
+
+/**
+ * @brief 正解の lab ファイル (開始秒数 TAB 終了秒数 TAB 音素) を読む
+ */
+Alignment read_lab_file(std::filesystem::path const &lab_file) {
+  Alignment labels;
+  std::ifstream ifs(lab_file);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::istringstream ss(line);
+    double begin_sec, end_sec;
+    std::string phoneme;
+    if (ss >> begin_sec >> end_sec >> phoneme) {
+      labels.emplace_back(begin_sec, end_sec, phoneme);
+    }
+  }
+  return labels;
+}
+
+void print_table(char const *title, DeviationTable const &table) {
+  std::cout << title << std::endl;
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "  " << std::left << std::setw(8) << "phoneme" << std::right << std::setw(8) << "count" << std::setw(12)
+            << "mean[ms]" << std::setw(12) << "max[ms]" << std::setw(10) << "<=20ms" << std::endl;
+  auto print_row = [](std::string const &name, DeviationStats const &stats) {
+    std::cout << "  " << std::left << std::setw(8) << name << std::right << std::setw(8) << stats.count << std::setw(12)
+              << stats.mean_abs_ms() << std::setw(12) << stats.max_abs_ms << std::setw(9)
+              << (stats.count ? 100.0 * stats.within_20ms / stats.count : 0.0) << "%" << std::endl;
+  };
+  for (auto const &[phoneme, stats] : table.per_phoneme) {
+    print_row(phoneme, stats);
+  }
+  print_row("(all)", table.total);
+}
+
+std::string to_json(DeviationTable const &table) {
+  auto stats_to_json = [](DeviationStats const &stats) {
+    std::ostringstream ss;
+    ss << "{\"count\": " << stats.count << ", \"mean_abs_ms\": " << stats.mean_abs_ms()
+       << ", \"max_abs_ms\": " << stats.max_abs_ms << ", \"within_10ms\": " << stats.within_10ms
+       << ", \"within_20ms\": " << stats.within_20ms << ", \"within_50ms\": " << stats.within_50ms << "}";
+    return ss.str();
+  };
+  std::ostringstream ss;
+  ss << "{\"total\": " << stats_to_json(table.total) << ", \"per_phoneme\": {";
+  bool first = true;
+  for (auto const &[phoneme, stats] : table.per_phoneme) {
+    ss << (first ? "" : ", ") << "\"" << phoneme << "\": " << stats_to_json(stats);
+    first = false;
+  }
+  ss << "}}";
+  return ss.str();
+}
+
+double stage_ms(domino::Metrics const &metrics, char const *stage) {
+  for (auto const &[name, elapsed_ms] : metrics.timings_ms()) {
+    if (name == stage) {
+      return elapsed_ms;
+    }
+  }
+  return 0.0;
+}
+
+// すべてのファイルを飛ばしたときなど、分母が 0 なら NaN を返す
+double speed_up(double const reference_ms, double const candidate_ms) {
+  return candidate_ms > 0.0 ? reference_ms / candidate_ms : std::numeric_limits<double>::quiet_NaN();
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  argparse::ArgumentParser program("Domino Evaluation");
+  program.add_argument("--input_path")
+      .required()
+      .nargs(1)
+      .help("wav ファイルと txt ファイルの入ったディレクトリです。同じ名前の lab ファイルがあれば正解として使います。");
+  program.add_argument("--reference_onnx").required().nargs(1).help("基準にするonnxファイルパスです。");
+  program.add_argument("--candidate_onnx").required().nargs(1).help("比較するonnxファイルパス (量子化モデルなど) です。");
+  program.add_argument("--output_path").nargs(1).help("指定すると、結果を JSON でこのファイルに書き出します。");
+  program.add_argument("--min_frame")
+      .nargs(1)
+      .help("1音素が割り当てられる最低フレーム数です。デフォルトは 3 です。")
+      .default_value(3)
+      .scan<'i', int>();
+  program.add_argument("--intra_op_threads")
+      .nargs(1)
+      .help("ONNX Runtime の推論に使うスレッド数です。デフォルトの 0 は ONNX Runtime のデフォルトです。")
+      .default_value(0)
+      .scan<'i', int>();
+  program.add_argument("--graph_optimization")
+      .nargs(1)
+      .help("ONNX Runtime のグラフ最適化レベル (disable, basic, extended, all) です。デフォルトは \"all\" です。")
+      .default_value(std::string("all"));
+
+  try {
+    program.parse_args(argc, argv);
+
+    domino::AlignerOptions options;
+    options.intra_op_num_threads = program.get<int>("--intra_op_threads");
+    options.graph_optimization_level =
+        domino::parse_graph_optimization_level(program.get<std::string>("--graph_optimization"));
+    domino::Aligner reference(program.present<std::string>("--reference_onnx").value(), 3, options);
+    domino::Aligner candidate(program.present<std::string>("--candidate_onnx").value(), 3, options);
+    int const N = program.get<int>("--min_frame");
+
+    std::vector<std::filesystem::path> wav_files;
+    std::filesystem::path const input_path = program.present<std::string>("--input_path").value();
+    for (std::filesystem::directory_entry const &file : std::filesystem::directory_iterator{input_path}) {
+      if (std::filesystem::is_regular_file(file.path()) && file.path().extension() == ".wav") {
+        wav_files.push_back(file.path());
+      }
+    }
+    std::sort(wav_files.begin(), wav_files.end());
+    if (wav_files.empty()) {
+      throw std::runtime_error("no wav file in " + input_path.string());
+    }
+
+    DeviationTable candidate_vs_reference;
+    DeviationTable reference_vs_label;
+    DeviationTable candidate_vs_label;
+    double reference_ort_ms = 0.0, candidate_ort_ms = 0.0;
+    double reference_total_ms = 0.0, candidate_total_ms = 0.0;
+    double audio_sec = 0.0;
+    std::size_t num_skipped = 0;
+    bool warmed_up = false;
+
+    for (std::filesystem::path const &wav_file : wav_files) {
+      std::vector<float> wav_data;
+      if (int const load_result = load_wav(wav_file.string().c_str(), wav_data); load_result != 0) {
+        std::cerr << "[warn] skip invalid wav file (" << load_result << "): " << wav_file << std::endl;
+        ++num_skipped;
+        continue;
+      }
+      std::vector<int> token_ids;
+      try {
+        token_ids = reference.read_phonemes(std::filesystem::path(wav_file).replace_extension(".txt"));
+      } catch (std::exception const &e) {
+        std::cerr << "[warn] skip " << wav_file << ": " << e.what() << std::endl;
+        ++num_skipped;
+        continue;
+      }
+
+      if (!warmed_up) {
+        // 初回の推論はメモリ確保などで遅いので、計測の前に1回ずつ流しておく
+        reference.align(wav_data.data(), wav_data.size(), token_ids, N);
+        candidate.align(wav_data.data(), wav_data.size(), token_ids, N);
+        warmed_up = true;
+      }
+
+      domino::Metrics reference_metrics, candidate_metrics;
+      Alignment reference_alignment, candidate_alignment;
+      {
+        domino::ScopedTimer const timer(&reference_metrics, "total");
+        reference_alignment = reference.align(wav_data.data(), wav_data.size(), token_ids, N, &reference_metrics);
+      }
+      {
+        domino::ScopedTimer const timer(&candidate_metrics, "total");
+        candidate_alignment = candidate.align(wav_data.data(), wav_data.size(), token_ids, N, &candidate_metrics);
+      }
+      reference_ort_ms += stage_ms(reference_metrics, "ort_run");
+      candidate_ort_ms += stage_ms(candidate_metrics, "ort_run");
+      reference_total_ms += stage_ms(reference_metrics, "total");
+      candidate_total_ms += stage_ms(candidate_metrics, "total");
+      audio_sec += wav_data.size() / 16000.0;
+
+      candidate_vs_reference.add(reference_alignment, candidate_alignment);
+
+      std::filesystem::path const lab_file = std::filesystem::path(wav_file).replace_extension(".lab");
+      if (std::filesystem::is_regular_file(lab_file)) {
+        Alignment const labels = read_lab_file(lab_file);
+        if (!reference_vs_label.add(labels, reference_alignment) ||
+            !candidate_vs_label.add(labels, candidate_alignment)) {
+          std::cerr << "[warn] number of phonemes differs from " << lab_file << std::endl;
+        }
+      }
+    }
+
+    std::cout << "files: " << wav_files.size() - num_skipped << " (skipped: " << num_skipped << "), audio: "
+              << std::fixed << std::setprecision(1) << audio_sec << " [sec]" << std::endl;
+    if (num_skipped == wav_files.size()) {
+      throw std::runtime_error("all wav files in " + input_path.string() + " were skipped");
+    }
+    std::cout << "ort_run: reference " << reference_ort_ms << " [ms], candidate " << candidate_ort_ms
+              << " [ms], speed-up x" << std::setprecision(2) << speed_up(reference_ort_ms, candidate_ort_ms)
+              << std::endl;
+    std::cout << "total:   reference " << std::setprecision(1) << reference_total_ms << " [ms], candidate "
+              << candidate_total_ms << " [ms], speed-up x" << std::setprecision(2)
+              << speed_up(reference_total_ms, candidate_total_ms) << std::endl;
+    print_table("boundary deviation (candidate vs reference):", candidate_vs_reference);
+    if (reference_vs_label.total.count > 0) {
+      print_table("boundary deviation (reference vs label):", reference_vs_label);
+      print_table("boundary deviation (candidate vs label):", candidate_vs_label);
+    }
+
+    if (program.present<std::string>("--output_path")) {
+      std::ofstream ofs(program.present<std::string>("--output_path").value());
+      ofs << "{\"files\": " << wav_files.size() - num_skipped << ", \"skipped\": " << num_skipped
+          << ", \"audio_sec\": " << audio_sec << ", \"reference_ort_ms\": " << reference_ort_ms
+          << ", \"candidate_ort_ms\": " << candidate_ort_ms
+          << ", \"reference_total_ms\": " << reference_total_ms << ", \"candidate_total_ms\": " << candidate_total_ms
+          << ", \"candidate_vs_reference\": " << to_json(candidate_vs_reference);
+      if (reference_vs_label.total.count > 0) {
+        ofs << ", \"reference_vs_label\": " << to_json(reference_vs_label)
+            << ", \"candidate_vs_label\": " << to_json(candidate_vs_label);
+      }
+      ofs << "}" << std::endl;
+    }
+  } catch (Ort::Exception const &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  } catch (std::exception const &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
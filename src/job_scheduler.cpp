@@ -0,0 +1,93 @@
+#include "job_scheduler.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace domino {
+namespace {
+constexpr std::size_t kSamplesPerTimeframe = 160;  // 16kHz で 10ミリ秒
+
+// 時間フレーム数が 2 の何乗の範囲に入るかでバケットに分ける
+int length_bucket(std::size_t const num_samples) {
+  std::size_t const num_timeframes = num_samples / kSamplesPerTimeframe + 1;
+  return static_cast<int>(std::log2(static_cast<double>(num_timeframes)));
+}
+}  // namespace
+
+std::size_t MemoryModel::estimate_bytes(std::size_t const num_samples, std::size_t const num_tokens) const {
+  std::size_t const num_timeframes = num_samples / kSamplesPerTimeframe + 1;
+  std::size_t const num_lattice_cells = num_timeframes * (2 * num_tokens + 1);
+  std::size_t const num_output_columns = token_conditioned ? num_tokens : num_transition_vocab;
+
+  // load_wav の s16 の一時バッファと float の波形
+  std::size_t const wav_bytes = num_samples * (sizeof(short) + sizeof(float));
+  std::size_t const activation_bytes = num_timeframes * activation_bytes_per_frame;
+  // transition_logprobs と blank_logprobs
+  std::size_t const ort_output_bytes = num_timeframes * (num_output_columns + 1) * sizeof(float);
+  // log_emission_probs と forward_logprobs が float、is_transition が 1bit、並列版の遷移フラグが 1バイト
+  std::size_t const viterbi_bytes = num_lattice_cells * (2 * sizeof(float) + 1) + num_lattice_cells / 8;
+  // viterbi_posterior の scaled_gains (float) と backward_probs (double)、トークンごとの max_gains、
+  // 時間フレームごとの forward_probs と prev_forward_probs (double)
+  std::size_t const posterior_bytes =
+      with_confidence ? num_timeframes * num_tokens * (sizeof(float) + sizeof(double)) + num_tokens * sizeof(double) +
+                            2 * num_timeframes * sizeof(double)
+                      : 0;
+  return wav_bytes + activation_bytes + ort_output_bytes + viterbi_bytes + posterior_bytes;
+}
+
+JobScheduler::JobScheduler(std::vector<AlignmentJob> jobs, std::size_t const memory_budget_bytes)
+    : memory_budget_bytes_(memory_budget_bytes) {
+  // 長いバケットから実行すると、最後に短いジョブで隙間を埋められる
+  std::stable_sort(jobs.begin(), jobs.end(), [](AlignmentJob const &a, AlignmentJob const &b) {
+    return length_bucket(a.num_samples) > length_bucket(b.num_samples);
+  });
+  for (AlignmentJob &job : jobs) {
+    if (memory_budget_bytes_ > 0 && job.estimated_bytes > memory_budget_bytes_) {
+      oversized_jobs_.push_back(std::move(job));
+    } else {
+      pending_jobs_.push_back(std::move(job));
+    }
+  }
+  num_oversized_jobs_ = oversized_jobs_.size();
+}
+
+std::optional<AlignmentJob> JobScheduler::acquire() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    if (!pending_jobs_.empty()) {
+      // 先頭のジョブが予算に収まらなければ、後ろのより短いジョブで空きを埋める
+      auto const it = std::find_if(pending_jobs_.begin(), pending_jobs_.end(), [this](AlignmentJob const &job) {
+        return memory_budget_bytes_ == 0 || reserved_bytes_ + job.estimated_bytes <= memory_budget_bytes_;
+      });
+      if (it != pending_jobs_.end()) {
+        AlignmentJob job = std::move(*it);
+        pending_jobs_.erase(it);
+        reserved_bytes_ += job.estimated_bytes;
+        ++num_running_jobs_;
+        return job;
+      }
+    } else if (!oversized_jobs_.empty()) {
+      // 予算を超えるジョブは他のジョブがすべて終わってから単独で実行する
+      if (num_running_jobs_ == 0) {
+        AlignmentJob job = std::move(oversized_jobs_.front());
+        oversized_jobs_.pop_front();
+        reserved_bytes_ += job.estimated_bytes;
+        ++num_running_jobs_;
+        return job;
+      }
+    } else {
+      return std::nullopt;
+    }
+    cv_.wait(lock);
+  }
+}
+
+void JobScheduler::release(AlignmentJob const &job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reserved_bytes_ -= job.estimated_bytes;
+    --num_running_jobs_;
+  }
+  cv_.notify_all();
+}
+}  // namespace domino
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace domino {
+/**
+ * @brief Aligner::align 1回分のピークメモリの見積もりに使う係数
+ *
+ */
+struct MemoryModel {
+  // Transformer の活性化など、ONNX Runtime が推論中に確保する 1時間フレームあたりのバイト数。
+  // モデルごとに異なるので、実測したピーク RSS から合わせる
+  std::size_t activation_bytes_per_frame = 64 * 1024;
+  // token_ids を入力に取らないモデルの transition_logprobs の列数 (音素遷移の語彙数)。
+  // token_conditioned が true のときは列数が入力トークン数になるので、この値は使わない
+  std::size_t num_transition_vocab = 556;
+  // モデルが token_ids を入力に取り、transition_logprobs を入力トークンの列だけに絞って出力するか
+  bool token_conditioned = false;
+  // 信頼度を求める (--confidence か --output_format=json) ときは、後ろ向き計算のバッファも見積もりに含める
+  bool with_confidence = false;
+
+  /**
+   * @brief WAV のサンプル数と音素遷移トークン数から、1回のアラインメントのピークメモリを見積もる
+   *
+   * @return std::size_t 見積もったバイト数
+   */
+  std::size_t estimate_bytes(std::size_t const num_samples, std::size_t const num_tokens) const;
+};
+
+struct AlignmentJob {
+  std::filesystem::path wav_file;
+  std::filesystem::path txt_file;
+  std::filesystem::path output_file;
+  std::size_t num_samples = 0;
+  std::size_t num_tokens = 0;
+  std::size_t estimated_bytes = 0;
+  // 見積もりのために読み込んだ音素遷移トークン列。実行時にもう一度 txt ファイルを読まずに済むように持っておく
+  std::vector<int> token_ids;
+};
+
+/**
+ * @brief 見積もったメモリの合計が予算を超えないようにジョブを実行に回すスケジューラ。
+ * ジョブは長さごとのバケットにまとめ、長いバケットから順に実行する。予算を単独で超えるジョブは専用のレーンに回し、
+ * 通常のジョブがすべて終わったあとで1つずつ単独で実行する
+ *
+ */
+class JobScheduler {
+ public:
+  // memory_budget_bytes が 0 のときは予算を設けない
+  JobScheduler(std::vector<AlignmentJob> jobs, std::size_t const memory_budget_bytes);
+
+  // 予算内で実行できるジョブを待って返す。ジョブが残っていなければ std::nullopt を返す
+  std::optional<AlignmentJob> acquire();
+  // acquire で受け取ったジョブが終わったときに呼ぶ
+  void release(AlignmentJob const &job);
+
+  std::size_t num_oversized_jobs() const { return num_oversized_jobs_; }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<AlignmentJob> pending_jobs_;    // 長さのバケット順
+  std::deque<AlignmentJob> oversized_jobs_;  // 予算を単独で超えるジョブ
+  std::size_t const memory_budget_bytes_;
+  std::size_t num_oversized_jobs_ = 0;
+  std::size_t reserved_bytes_ = 0;
+  int num_running_jobs_ = 0;
+};
+}  // namespace domino
@@ -6,9 +6,58 @@
 
 namespace py = pybind11;
 
+namespace {
+py::dict to_dict(domino::Metrics const &metrics) {
+  py::dict timings_ms;
+  for (auto const &[stage, elapsed_ms] : metrics.timings_ms()) {
+    timings_ms[py::str(stage)] = elapsed_ms;
+  }
+  py::dict counts;
+  for (auto const &[name, value] : metrics.counts()) {
+    counts[py::str(name)] = value;
+  }
+  py::dict stats;
+  stats["timings_ms"] = timings_ms;
+  stats["counts"] = counts;
+  return stats;
+}
+}  // namespace
+
 PYBIND11_MODULE(pydomino_cpp, mod) {
   py::class_<domino::Aligner>(mod, "Aligner_cpp")
-      .def(py::init<std::string>())
-      .def("align", &domino::Aligner::align_phonemes)
+      .def(py::init([](std::string const &path, std::string const &profile_file_prefix, int const viterbi_num_threads,
+                       int const intra_op_num_threads, std::string const &graph_optimization, bool const fork_safe) {
+             domino::AlignerOptions options;
+             options.profile_file_prefix = profile_file_prefix;
+             options.viterbi_num_threads = viterbi_num_threads;
+             options.intra_op_num_threads = intra_op_num_threads;
+             options.graph_optimization_level = domino::parse_graph_optimization_level(graph_optimization);
+             options.fork_safe = fork_safe;
+             return std::make_unique<domino::Aligner>(path, 3, options);
+           }),
+           py::arg("path"), py::arg("profile_file_prefix") = "", py::arg("viterbi_num_threads") = 1,
+           py::arg("intra_op_num_threads") = 0, py::arg("graph_optimization") = "all", py::arg("fork_safe") = false)
+      .def("align",
+           [](domino::Aligner &aligner, Eigen::Ref<Eigen::VectorXf> const wav, std::string const &phonemes, int N) {
+             return aligner.align_phonemes(wav, phonemes, N);
+           })
+      .def("align_with_confidence",
+           [](domino::Aligner &aligner, Eigen::Ref<Eigen::VectorXf> const wav, std::string const &phonemes, int N) {
+             domino::AlignmentScores scores;
+             auto const labels = aligner.align_phonemes(wav, phonemes, N, &scores);
+             py::list alignment;
+             for (std::size_t i = 0; i < labels.size(); ++i) {
+               auto const &[begin_sec, end_sec, phoneme] = labels[i];
+               alignment.append(py::make_tuple(begin_sec, end_sec, phoneme, scores.confidences[i], scores.logprobs[i]));
+             }
+             py::dict result;
+             result["alignment"] = alignment;
+             result["confidence"] = scores.utterance_confidence;
+             result["logprob"] = scores.utterance_logprob;
+             result["total_logprob"] = scores.utterance_total_logprob;
+             return result;
+           })
+      .def("stats", [](domino::Aligner const &aligner) { return to_dict(aligner.last_metrics()); })
+      .def("end_profiling", &domino::Aligner::end_profiling)
       .def("release", &domino::Aligner::release);
 }
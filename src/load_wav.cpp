@@ -13,31 +13,8 @@ void read_datrum(T& datrum, std::ifstream &ifs)
     ifs.read(reinterpret_cast<char*>(&datrum), sizeof(datrum));
 }
 
-/// # WAV File Format
-/// 'RIFF'  : u32 (4B) RIFF識別子
-///   size  : u32 (4B) チャンク サイズ
-/// 'WAVE'  : u32 (4B) フォーマット
-///
-///   'fmt ': u32 (4B) fmt識別子
-///       16: u32 (4B) fmtチャンクのバイト数
-///        1: u16 (2B) 音声フォーマット
-///        1: u16 (2B) チャンネル数
-///    16000: u32 (4B) サンプリング周波数
-///    32000: u32 (4B) 1 秒あたりバイト数の平均
-///        2: u16 (2B) ブロックサイズ
-///       16: u16 (2B) ビット／サンプル
-///
-///   'data': u32 (4B) data識別子
-///     size: u32 (4B) dataチャンクのバイト数
-///     data: s16[size]
-int load_wav(char const* mono_16kHz_16bit_wav_file, std::vector<float>& wav_data) {
-    wav_data.clear();
-
-    std::ifstream ifs(mono_16kHz_16bit_wav_file, std::ios::binary);
-    if (!ifs) {
-        return 1;
-    }
-
+/// RIFF ヘッダと fmt チャンクを読んで検査する。成功したら 0、失敗したら負のエラーコードを返す
+static int read_wav_header(std::ifstream &ifs) {
     char riff[4];
     read_datrum(riff, ifs);
     if (!std::memcmp(riff, "FFIR", 4)) {
@@ -108,6 +85,39 @@ int load_wav(char const* mono_16kHz_16bit_wav_file, std::vector<float>& wav_data
         return -10;
     }
 
+    return 0;
+}
+
+/// # WAV File Format
+/// 'RIFF'  : u32 (4B) RIFF識別子
+///   size  : u32 (4B) チャンク サイズ
+/// 'WAVE'  : u32 (4B) フォーマット
+///
+///   'fmt ': u32 (4B) fmt識別子
+///       16: u32 (4B) fmtチャンクのバイト数
+///        1: u16 (2B) 音声フォーマット
+///        1: u16 (2B) チャンネル数
+///    16000: u32 (4B) サンプリング周波数
+///    32000: u32 (4B) 1 秒あたりバイト数の平均
+///        2: u16 (2B) ブロックサイズ
+///       16: u16 (2B) ビット／サンプル
+///
+///   'data': u32 (4B) data識別子
+///     size: u32 (4B) dataチャンクのバイト数
+///     data: s16[size]
+int load_wav(char const* mono_16kHz_16bit_wav_file, std::vector<float>& wav_data) {
+    wav_data.clear();
+
+    std::ifstream ifs(mono_16kHz_16bit_wav_file, std::ios::binary);
+    if (!ifs) {
+        return 1;
+    }
+
+    int const header_result = read_wav_header(ifs);
+    if (header_result != 0) {
+        return header_result;
+    }
+
     while (ifs)
     {
         // 'data': u32 (4B) data識別子
@@ -146,3 +156,38 @@ int load_wav(char const* mono_16kHz_16bit_wav_file, std::vector<float>& wav_data
 
     return 0;
 }
+
+int read_wav_num_samples(char const* mono_16kHz_16bit_wav_file, std::size_t& num_samples) {
+    num_samples = 0;
+
+    std::ifstream ifs(mono_16kHz_16bit_wav_file, std::ios::binary);
+    if (!ifs) {
+        return 1;
+    }
+
+    int const header_result = read_wav_header(ifs);
+    if (header_result != 0) {
+        return header_result;
+    }
+
+    // サンプルは読まずに、data チャンクのバイト数だけを見る
+    while (ifs)
+    {
+        char chk_identifier[4];
+        read_datrum(chk_identifier, ifs);
+        if (ifs.eof()) {
+            break;
+        }
+
+        uint32_t size;
+        read_datrum(size, ifs);
+
+        if (!std::memcmp(chk_identifier, "data", 4)) {
+            num_samples = size / 2;
+            return 0;
+        }
+        ifs.seekg(size, std::ios_base::cur);
+    }
+
+    return -11;
+}
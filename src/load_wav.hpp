@@ -1,5 +1,9 @@
 ﻿#pragma once
+#include <cstddef>
 #include <vector>
 
 int load_wav(char const* mono_16kHz_16bit_wav_file, std::vector<float>& wav_data);
 
+// サンプルを読み込まずに、ヘッダからサンプル数だけを取得する
+int read_wav_num_samples(char const* mono_16kHz_16bit_wav_file, std::size_t& num_samples);
+
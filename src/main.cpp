@@ -1,24 +1,42 @@
 ﻿#include <argparse/argparse.hpp>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
 #include <exception>
 #include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <iterator>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
 
+#include "bounded_queue.hpp"
 #include "domino.hpp"
+#include "job_scheduler.hpp"
 #include "load_wav.hpp"
+#include "metrics.hpp"
 
 namespace {
+// --quiet のときは false にして、進捗などの出力を止める
+bool verbose = true;
+
+std::ostream &info_stream() {
+  static std::ostream null_stream(nullptr);
+  return verbose ? std::cout : null_stream;
+}
+
 class ElapsedTimer {
  public:
   ElapsedTimer(char const *name) : name_(name), start_(std::chrono::system_clock::now()) {}
 
   ~ElapsedTimer() {
     std::chrono::system_clock::time_point const end = std::chrono::system_clock::now();
-    std::cout << "elapsed time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start_).count()
-              << " [ms] (" << name_ << ")" << std::endl;
+    info_stream() << "elapsed time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start_).count()
+                  << " [ms] (" << name_ << ")" << std::endl;
   }
 
  private:
@@ -36,30 +54,70 @@ std::filesystem::path with_suffix(std::filesystem::path const &file, char const
   return parent_dir ? parent_dir.value() / new_path.filename() : new_path;
 }
 
+// scores が nullptr でなければ、4列目に信頼度、5列目に平均対数尤度を書く
 void write_lab_file(std::vector<std::tuple<double, double, std::string>> const &labels,
-                    std::filesystem::path const &lab_file) {
-  std::cout << "write_lab_file start: \"" << lab_file << "\"" << std::endl;
+                    std::filesystem::path const &lab_file, domino::AlignmentScores const *scores = nullptr) {
+  info_stream() << "write_lab_file start: \"" << lab_file << "\"" << std::endl;
   std::ofstream lab_ofs(lab_file);
   lab_ofs << std::fixed << std::setprecision(3);
-  for (auto const [begin_sec, end_sec, phoneme] : labels) {
-    lab_ofs << begin_sec << "\t" << end_sec << "\t" << phoneme << std::endl;
+  for (std::size_t i = 0; i < labels.size(); ++i) {
+    auto const &[begin_sec, end_sec, phoneme] = labels[i];
+    lab_ofs << begin_sec << "\t" << end_sec << "\t" << phoneme;
+    if (scores) {
+      lab_ofs << "\t" << scores->confidences[i] << "\t" << scores->logprobs[i];
+    }
+    lab_ofs << std::endl;
+  }
+  info_stream() << "write_lab_file end: \"" << lab_file << "\"" << std::endl;
+}
+
+// JSON には NaN がないので、NaN (フレームが割り当てられなかった音素の平均対数尤度) は null にする
+std::string to_json_number(float const value) {
+  if (std::isnan(value)) {
+    return "null";
   }
-  std::cout << "write_lab_file end: \"" << lab_file << "\"" << std::endl;
+  std::ostringstream ss;
+  ss << std::fixed << std::setprecision(3) << value;
+  return ss.str();
 }
 
+// 音素ごとの開始・終了秒数、音素、信頼度、平均対数尤度と、発話全体のスコアを JSON で書く
+void write_json_file(std::vector<std::tuple<double, double, std::string>> const &labels,
+                     domino::AlignmentScores const &scores, std::filesystem::path const &json_file) {
+  info_stream() << "write_json_file start: \"" << json_file << "\"" << std::endl;
+  std::ofstream json_ofs(json_file);
+  json_ofs << std::fixed << std::setprecision(3);
+  json_ofs << "{\"confidence\": " << scores.utterance_confidence << ", \"logprob\": " << scores.utterance_logprob
+           << ", \"total_logprob\": " << scores.utterance_total_logprob << ", \"alignment\": [";
+  for (std::size_t i = 0; i < labels.size(); ++i) {
+    auto const &[begin_sec, end_sec, phoneme] = labels[i];
+    json_ofs << (i == 0 ? "" : ", ") << "{\"begin\": " << begin_sec << ", \"end\": " << end_sec
+             << ", \"phoneme\": \"" << phoneme << "\", \"confidence\": " << scores.confidences[i]
+             << ", \"logprob\": " << to_json_number(scores.logprobs[i]) << "}";
+  }
+  json_ofs << "]}" << std::endl;
+  info_stream() << "write_json_file end: \"" << json_file << "\"" << std::endl;
+}
+
+// scores が nullptr でなければ、音素ごとの信頼度を3つ目の tier に書く
 void write_textGrid_file(std::vector<std::tuple<double, double, std::string>> const &alignment,
-                         std::filesystem::path const &textGrid_file) {
+                         std::filesystem::path const &textGrid_file, domino::AlignmentScores const *scores = nullptr) {
   // まずはじめに、開始秒数と終了秒数の等しい要素を削除した alignment を作っておく
   std::vector<std::tuple<double, double, std::string>> non_zero_duration_alignment;
-  for (auto const [begin_sec, end_sec, phoneme] : alignment) {
+  std::vector<float> non_zero_duration_confidences;
+  for (std::size_t i = 0; i < alignment.size(); ++i) {
+    auto const &[begin_sec, end_sec, phoneme] = alignment[i];
     if (end_sec - begin_sec == 0) {
       continue;
     } else {
       non_zero_duration_alignment.push_back({begin_sec, end_sec, phoneme});
+      if (scores) {
+        non_zero_duration_confidences.push_back(scores->confidences[i]);
+      }
     }
   }
 
-  std::cout << "write_TextGrid_file start: \"" << textGrid_file << "\"" << std::endl;
+  info_stream() << "write_TextGrid_file start: \"" << textGrid_file << "\"" << std::endl;
   std::ofstream textGrid_ofs(textGrid_file);
   textGrid_ofs << std::fixed << std::setprecision(3);
 
@@ -72,7 +130,7 @@ void write_textGrid_file(std::vector<std::tuple<double, double, std::string>> co
   textGrid_ofs << "xmin = 0" << std::endl;
   textGrid_ofs << "xmax = " << total_duration << std::endl;
   textGrid_ofs << "tiers? <exists>" << std::endl;
-  textGrid_ofs << "size = 2" << std::endl;
+  textGrid_ofs << "size = " << (scores ? 3 : 2) << std::endl;
 
   textGrid_ofs << "item []:" << std::endl;
 
@@ -104,6 +162,301 @@ void write_textGrid_file(std::vector<std::tuple<double, double, std::string>> co
     textGrid_ofs << "            xmax = " << end_sec << std::endl;
     textGrid_ofs << "            text = \"" << phoneme << "\"" << std::endl;
   }
+
+  if (scores) {
+    textGrid_ofs << "    item [3]:" << std::endl;
+    textGrid_ofs << "        class = \"IntervalTier\"" << std::endl;
+    textGrid_ofs << "        name = \"confidence\"" << std::endl;
+    textGrid_ofs << "        xmin = 0" << std::endl;
+    textGrid_ofs << "        xmax = " << total_duration << std::endl;
+    textGrid_ofs << "        intervals: size = " << non_zero_duration_alignment.size() << std::endl;
+    for (std::size_t i = 0; i < non_zero_duration_alignment.size(); ++i) {
+      textGrid_ofs << "        intervals[" << i + 1 << "]:" << std::endl;
+      textGrid_ofs << "            xmin = " << std::get<0>(non_zero_duration_alignment[i]) << std::endl;
+      textGrid_ofs << "            xmax = " << std::get<1>(non_zero_duration_alignment[i]) << std::endl;
+      textGrid_ofs << "            text = \"" << non_zero_duration_confidences[i] << "\"" << std::endl;
+    }
+  }
+}
+
+/**
+ * @brief 1つの wav ファイルをアラインメントして結果を書き出す
+ *
+ * @param wav_file 入力の wav ファイル
+ * @param input_phoneme 指定されていれば、txt ファイルの代わりにこの音素列を使う
+ * @param txt_file input_phoneme がないときに音素列を読む txt ファイル
+ * @param output_file 結果を書き出すファイル
+ * @param output_format 出力形式 (lab, TextGrid, json)
+ * @param N 1音素に割り当てる最小時間フレーム数
+ * @param with_confidence true なら音素ごとの信頼度も求めて書き出す。json 形式では常に書き出す
+ * @return domino::Metrics 各ステージの計測結果
+ */
+domino::Metrics align_file(domino::Aligner &aligner, std::filesystem::path const &wav_file,
+                           std::optional<std::string> const &input_phoneme, std::filesystem::path const &txt_file,
+                           std::filesystem::path const &output_file, std::string const &output_format, int const N,
+                           bool const with_confidence) {
+  domino::Metrics metrics;
+  domino::ScopedTimer const total_timer(&metrics, "total");
+
+  std::vector<int> phonemes_index;
+  {
+    domino::ScopedTimer const timer(&metrics, "read_phonemes");
+    phonemes_index = input_phoneme ? aligner.read_phonemes(input_phoneme.value()) : aligner.read_phonemes(txt_file);
+  }
+
+  std::vector<float> wav_data;
+  {
+    domino::ScopedTimer const timer(&metrics, "load_wav");
+    int const load_result = load_wav(wav_file.string().c_str(), wav_data);
+    info_stream() << "load_wav(" << load_result << "): " << wav_data.size() << std::endl;
+  }
+  metrics.set_count("wav_bytes", wav_data.size() * sizeof(float));
+
+  domino::AlignmentScores scores;
+  domino::AlignmentScores *const scores_ptr = (with_confidence || output_format == "json") ? &scores : nullptr;
+  auto const labels = aligner.align(wav_data.data(), wav_data.size(), phonemes_index, N, &metrics, scores_ptr);
+  {
+    domino::ScopedTimer const timer(&metrics, "write_output");
+    if (output_format == "lab") {
+      write_lab_file(labels, output_file, scores_ptr);
+    } else if (output_format == "json") {
+      write_json_file(labels, scores, output_file);
+    } else {
+      write_textGrid_file(labels, output_file, scores_ptr);
+    }
+  }
+  return metrics;
+}
+
+struct PipelineOptions {
+  // WAV を先読みするスレッド数。音素列はメモリの見積もりのときに読み込み済み
+  int num_reader_threads = 2;
+  // ONNX Runtime の推論を実行するスレッド数。セッションは共有する
+  int num_inference_threads = 1;
+  // Viterbi を解くスレッド数
+  int num_decode_threads = 2;
+  // ステージ間のキューの容量
+  std::size_t queue_depth = 4;
+};
+
+// パイプラインを流れる1ファイル分のデータ
+struct PipelineItem {
+  domino::AlignmentJob job;
+  std::vector<int> token_ids;
+  std::vector<float> wav_data;
+  domino::Emissions emissions;
+  std::vector<std::tuple<double, double, std::string>> labels;
+  domino::AlignmentScores scores;
+  domino::Metrics metrics;
+  std::chrono::steady_clock::time_point start;
+  // 各ステージで処理していた時間の合計。キューで待った時間は含まない
+  double processing_ms = 0.0;
+};
+
+/**
+ * @brief パイプラインの1ステージの稼働状況
+ */
+struct StageStats {
+  StageStats(char const *name, int const num_threads) : name(name), num_threads(num_threads) {}
+
+  char const *const name;
+  int const num_threads;
+  std::atomic<std::int64_t> busy_ns{0};
+  std::atomic<std::size_t> num_items{0};
+
+  // 稼働率。1 に近いステージがボトルネック
+  double occupancy(double const wall_ms) const { return busy_ns.load() / 1e6 / (wall_ms * num_threads); }
+};
+
+/**
+ * @brief スコープを抜けるまでの時間を StageStats の稼働時間と PipelineItem の処理時間に足すクラス
+ */
+class BusyTimer {
+ public:
+  BusyTimer(StageStats &stats, PipelineItem &item)
+      : stats_(stats), item_(item), start_(std::chrono::steady_clock::now()) {}
+  ~BusyTimer() {
+    std::chrono::nanoseconds const elapsed =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_);
+    stats_.busy_ns.fetch_add(elapsed.count(), std::memory_order_relaxed);
+    stats_.num_items.fetch_add(1, std::memory_order_relaxed);
+    item_.processing_ms += elapsed.count() / 1e6;
+  }
+
+ private:
+  StageStats &stats_;
+  PipelineItem &item_;
+  std::chrono::steady_clock::time_point const start_;
+};
+
+/**
+ * @brief 読み込み → 推論 → Viterbi → 書き出しの4ステージのパイプラインでディレクトリ内のファイルをアラインメントする。
+ * ステージ間は容量固定のロックフリーキューでつなぎ、読み込みと書き出しの I/O や Viterbi の間も推論を止めないようにする。
+ * メモリの予算は読み込みステージが scheduler から取り出すときに守り、書き出しステージが終わったファイルの分を返す
+ *
+ * @param stats_path 空でなければ、ステージごとの稼働率とキューの待ち時間を JSON で書き出す
+ */
+void run_pipeline(domino::Aligner &aligner, domino::JobScheduler &scheduler, PipelineOptions const &options,
+                  std::string const &output_format, int const N, bool const with_confidence,
+                  std::ofstream &metrics_ofs, std::optional<std::string> const &stats_path) {
+  using ItemPtr = std::unique_ptr<PipelineItem>;
+  domino::Channel<ItemPtr> inference_queue(options.queue_depth, options.num_reader_threads);
+  domino::Channel<ItemPtr> decode_queue(options.queue_depth, options.num_inference_threads);
+  domino::Channel<ItemPtr> write_queue(options.queue_depth, options.num_decode_threads);
+  StageStats read_stats("read", options.num_reader_threads);
+  StageStats inference_stats("inference", options.num_inference_threads);
+  StageStats decode_stats("viterbi", options.num_decode_threads);
+  StageStats write_stats("write", 1);
+  std::mutex error_mutex;
+
+  // 失敗したファイルはメッセージを出して、以降のステージに流さない
+  auto fail = [&](PipelineItem const &item, std::exception const &e) {
+    {
+      std::lock_guard<std::mutex> const lock(error_mutex);
+      std::cerr << item.job.wav_file.string() << ": " << e.what() << std::endl;
+    }
+    scheduler.release(item.job);
+  };
+
+  auto reader = [&]() {
+    while (std::optional<domino::AlignmentJob> job = scheduler.acquire()) {
+      ItemPtr item = std::make_unique<PipelineItem>();
+      item->job = std::move(job.value());
+      item->start = std::chrono::steady_clock::now();
+      try {
+        BusyTimer const busy(read_stats, *item);
+        // 音素列はメモリの見積もりのときに読み込み済み
+        item->token_ids = std::move(item->job.token_ids);
+        domino::ScopedTimer const timer(&item->metrics, "load_wav");
+        int const load_result = load_wav(item->job.wav_file.string().c_str(), item->wav_data);
+        if (load_result != 0) {
+          throw std::runtime_error("load_wav failed (" + std::to_string(load_result) + ")");
+        }
+      } catch (std::exception const &e) {
+        fail(*item, e);
+        continue;
+      }
+      item->metrics.set_count("wav_bytes", item->wav_data.size() * sizeof(float));
+      inference_queue.push(std::move(item));
+    }
+    inference_queue.close();
+  };
+
+  auto inference = [&]() {
+    for (ItemPtr item; inference_queue.pop(item);) {
+      try {
+        BusyTimer const busy(inference_stats, *item);
+        item->emissions = aligner.infer(item->wav_data.data(), item->wav_data.size(), item->token_ids, &item->metrics);
+      } catch (std::exception const &e) {
+        fail(*item, e);
+        continue;
+      }
+      // 推論が終われば波形は要らないので、Viterbi の待ち行列に並ぶ前に解放する
+      std::vector<float>().swap(item->wav_data);
+      decode_queue.push(std::move(item));
+    }
+    decode_queue.close();
+  };
+
+  auto decoder = [&]() {
+    for (ItemPtr item; decode_queue.pop(item);) {
+      try {
+        BusyTimer const busy(decode_stats, *item);
+        item->labels = aligner.decode(item->emissions, N, &item->metrics,
+                                      (with_confidence || output_format == "json") ? &item->scores : nullptr);
+      } catch (std::exception const &e) {
+        fail(*item, e);
+        continue;
+      }
+      item->emissions = domino::Emissions();
+      write_queue.push(std::move(item));
+    }
+    write_queue.close();
+  };
+
+  auto writer = [&]() {
+    for (ItemPtr item; write_queue.pop(item);) {
+      try {
+        BusyTimer const busy(write_stats, *item);
+        domino::ScopedTimer const timer(&item->metrics, "write_output");
+        domino::AlignmentScores const *const scores =
+            (with_confidence || output_format == "json") ? &item->scores : nullptr;
+        if (output_format == "lab") {
+          write_lab_file(item->labels, item->job.output_file, scores);
+        } else if (output_format == "json") {
+          write_json_file(item->labels, item->scores, item->job.output_file);
+        } else {
+          write_textGrid_file(item->labels, item->job.output_file, scores);
+        }
+      } catch (std::exception const &e) {
+        fail(*item, e);
+        continue;
+      }
+      // total は各ステージの処理時間の合計。pipeline_latency は読み込み開始から書き出し終了までで、キューで待った時間も含む
+      std::chrono::duration<double, std::milli> const latency = std::chrono::steady_clock::now() - item->start;
+      item->metrics.add_time("total", item->processing_ms);
+      item->metrics.add_time("pipeline_latency", latency.count());
+      item->metrics.set_count("estimated_bytes", item->job.estimated_bytes);
+      if (metrics_ofs) {
+        metrics_ofs << item->metrics.to_json(item->job.wav_file.string()) << std::endl;
+      }
+      scheduler.release(item->job);
+    }
+  };
+
+  auto const start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < options.num_reader_threads; ++i) {
+    threads.emplace_back(reader);
+  }
+  for (int i = 0; i < options.num_inference_threads; ++i) {
+    threads.emplace_back(inference);
+  }
+  for (int i = 0; i < options.num_decode_threads; ++i) {
+    threads.emplace_back(decoder);
+  }
+  writer();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  double const wall_ms =
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+  // ステージの稼働率と、その先のキューで待った時間を表示する。
+  // 稼働率が 1 に近く、手前のキューの push で待っているステージがボトルネック
+  StageStats const *const stages[] = {&read_stats, &inference_stats, &decode_stats, &write_stats};
+  domino::Channel<ItemPtr> const *const input_queues[] = {nullptr, &inference_queue, &decode_queue, &write_queue};
+  info_stream() << std::fixed << std::setprecision(1) << "pipeline: " << wall_ms << " [ms]" << std::endl;
+  for (std::size_t i = 0; i < std::size(stages); ++i) {
+    info_stream() << "  " << std::left << std::setw(10) << stages[i]->name << std::right
+                  << " threads: " << stages[i]->num_threads << ", items: " << stages[i]->num_items.load()
+                  << ", occupancy: " << 100.0 * stages[i]->occupancy(wall_ms) << "%";
+    if (input_queues[i]) {
+      info_stream() << ", input queue: mean depth " << input_queues[i]->mean_depth() << "/"
+                    << input_queues[i]->capacity() << ", producers waited " << input_queues[i]->push_wait_ms()
+                    << " [ms], consumers waited " << input_queues[i]->pop_wait_ms() << " [ms]";
+    }
+    info_stream() << std::endl;
+  }
+
+  if (stats_path) {
+    std::ofstream ofs(stats_path.value());
+    ofs << "{\"wall_ms\": " << wall_ms << ", \"stages\": [";
+    for (std::size_t i = 0; i < std::size(stages); ++i) {
+      ofs << (i == 0 ? "" : ", ") << "{\"name\": \"" << stages[i]->name << "\", \"threads\": "
+          << stages[i]->num_threads << ", \"items\": " << stages[i]->num_items.load()
+          << ", \"busy_ms\": " << stages[i]->busy_ns.load() / 1e6
+          << ", \"occupancy\": " << stages[i]->occupancy(wall_ms);
+      if (input_queues[i]) {
+        ofs << ", \"input_queue\": {\"capacity\": " << input_queues[i]->capacity()
+            << ", \"mean_depth\": " << input_queues[i]->mean_depth()
+            << ", \"push_wait_ms\": " << input_queues[i]->push_wait_ms()
+            << ", \"pop_wait_ms\": " << input_queues[i]->pop_wait_ms() << "}";
+      }
+      ofs << "}";
+    }
+    ofs << "]}" << std::endl;
+  }
 }
 }  // namespace
 
@@ -118,34 +471,128 @@ int main(int argc, char *argv[]) {
       .help("onnxファイルパスです。onnx_model/phoneme_transition_model.onnx を推奨します。");
   program.add_argument("--output_format")
       .nargs(1)
-      .help("出力ファイルのフォーマット。デフォルトは \"lab\"です。")
+      .help("出力ファイルのフォーマット (lab, TextGrid, json)。デフォルトは \"lab\"です。json は音素ごとの信頼度も含みます。")
       .default_value("lab");
   program.add_argument("--min_frame")
       .nargs(1)
       .help("1音素が割り当てられる最低フレーム数です。デフォルトは 3 です。")
       .default_value(3)
       .scan<'i', int>();
+  program.add_argument("--confidence")
+      .help("音素ごとの信頼度を求めて、lab では4・5列目 (信頼度・平均対数尤度)、TextGrid では3つ目の tier に書き出します。")
+      .default_value(false)
+      .implicit_value(true);
+  program.add_argument("--metrics_path")
+      .nargs(1)
+      .help("指定すると、ファイルごとの各ステージの所要時間などを JSON Lines 形式でこのファイルに書き出します。");
+  program.add_argument("--ort_profile")
+      .nargs(1)
+      .help("指定すると ONNX Runtime のプロファイラを有効にし、このプレフィックスのファイル名で結果を書き出します。");
+  program.add_argument("--viterbi_threads")
+      .nargs(1)
+      .help(
+          "長い音素列の Viterbi の前向き計算に使うスレッド数です。デフォルトは 1 (並列化しない) です。"
+          "0 はハードウェアのスレッド数で、ディレクトリの一括処理では --decode_threads で割った数です。")
+      .default_value(1)
+      .scan<'i', int>();
+  program.add_argument("--intra_op_threads")
+      .nargs(1)
+      .help("ONNX Runtime の推論に使うスレッド数です。デフォルトの 0 は ONNX Runtime のデフォルトです。")
+      .default_value(0)
+      .scan<'i', int>();
+  program.add_argument("--graph_optimization")
+      .nargs(1)
+      .help("ONNX Runtime のグラフ最適化レベル (disable, basic, extended, all) です。デフォルトは \"all\" です。")
+      .default_value(std::string("all"));
+  program.add_argument("--optimized_model_path")
+      .nargs(1)
+      .help("指定すると、最適化済みのモデルをこのパスに書き出します。");
+  program.add_argument("--num_workers")
+      .nargs(1)
+      .help("ディレクトリを入力したときに、ONNX Runtime の推論を並列に実行するスレッド数です。デフォルトは 1 です。")
+      .default_value(1)
+      .scan<'i', int>();
+  program.add_argument("--reader_threads")
+      .nargs(1)
+      .help("ディレクトリを入力したときに、wav ファイルを先読みするスレッド数です。デフォルトは 2 です。")
+      .default_value(2)
+      .scan<'i', int>();
+  program.add_argument("--decode_threads")
+      .nargs(1)
+      .help("ディレクトリを入力したときに、推論結果から Viterbi でアラインメントを求めるスレッド数です。デフォルトは 2 です。")
+      .default_value(2)
+      .scan<'i', int>();
+  program.add_argument("--queue_depth")
+      .nargs(1)
+      .help("ディレクトリを入力したときの、パイプラインのステージ間のキューの容量です。デフォルトは 4 です。")
+      .default_value(4)
+      .scan<'i', int>();
+  program.add_argument("--pipeline_stats_path")
+      .nargs(1)
+      .help("指定すると、ディレクトリを入力したときのパイプラインのステージごとの稼働率を JSON でこのファイルに書き出します。");
+  program.add_argument("--memory_budget")
+      .nargs(1)
+      .help("ディレクトリを入力したときに、同時に実行するアラインメントの見積もりメモリの合計の上限 (MiB) です。"
+            "超えるファイルは他のファイルが終わってから1つずつ実行します。デフォルトの 0 は上限なしです。")
+      .default_value(0)
+      .scan<'i', int>();
+  program.add_argument("--activation_kib_per_frame")
+      .nargs(1)
+      .help("メモリの見積もりに使う、推論中に確保される1時間フレーム (10ミリ秒) あたりのメモリ (KiB) です。"
+            "デフォルトは 64 です。")
+      .default_value(64)
+      .scan<'i', int>();
+  program.add_argument("--quiet").help("進捗や所要時間を標準出力に出力しません。").default_value(false).implicit_value(true);
 
   try {
     ElapsedTimer const total_timer("total");
 
     program.parse_args(argc, argv);
 
+    verbose = !program.get<bool>("--quiet");
+
     {
-      domino::Aligner aligner(program.present<std::string>("--onnx_path").value());
+      std::string const onnx_path = program.present<std::string>("--onnx_path").value();
+      domino::AlignerOptions options;
+      options.profile_file_prefix = program.present<std::string>("--ort_profile").value_or("");
+      PipelineOptions pipeline_options;
+      pipeline_options.num_reader_threads = std::max(1, program.get<int>("--reader_threads"));
+      pipeline_options.num_inference_threads = std::max(1, program.get<int>("--num_workers"));
+      pipeline_options.num_decode_threads = std::max(1, program.get<int>("--decode_threads"));
+      pipeline_options.queue_depth = std::max(1, program.get<int>("--queue_depth"));
+      options.viterbi_num_threads = program.get<int>("--viterbi_threads");
+      options.intra_op_num_threads = program.get<int>("--intra_op_threads");
+      options.graph_optimization_level =
+          domino::parse_graph_optimization_level(program.get<std::string>("--graph_optimization"));
+      options.optimized_model_path = program.present<std::string>("--optimized_model_path").value_or("");
+      if (options.viterbi_num_threads == 0 && std::filesystem::is_directory(program.get<std::string>("--input_path"))) {
+        // --viterbi_threads=0 を指定したときは、並列に Viterbi を解くスレッドの間でコアを分け合う
+        options.viterbi_num_threads = std::max(
+            1, static_cast<int>(std::thread::hardware_concurrency()) / pipeline_options.num_decode_threads);
+      }
+      domino::Aligner aligner(onnx_path, 3, options);
+      info_stream() << "path: " << onnx_path << std::endl;
 
       int const N = program.get<int>("--min_frame");
+      std::string const output_format = program.get<std::string>("--output_format");
+      bool const with_confidence = program.get<bool>("--confidence");
 
-      char const *output_file_ext = [&program]() {
-        const auto format = program.get<std::string>("--output_format");
-        if (format == "lab") {
+      char const *output_file_ext = [&output_format]() {
+        if (output_format == "lab") {
           return ".lab";
-        } else if (format == "TextGrid") {
+        } else if (output_format == "TextGrid") {
           return ".TextGrid";
+        } else if (output_format == "json") {
+          return ".json";
         }
-        throw std::invalid_argument("引数 output_format には、lab か TextGrid のどちらかを指定してください");
+        throw std::invalid_argument("引数 output_format には、lab か TextGrid か json のいずれかを指定してください");
       }();
 
+      std::ofstream metrics_ofs;
+      if (program.present<std::string>("--metrics_path")) {
+        metrics_ofs.open(program.present<std::string>("--metrics_path").value());
+      }
+
       {
         ElapsedTimer const total_timer("process");
 
@@ -154,32 +601,50 @@ int main(int argc, char *argv[]) {
         if (std::filesystem::is_directory(input_path)) {
           std::optional<std::filesystem::path> const output_dir =
               parse_path(program.present<std::string>("--output_path"));
+          domino::MemoryModel memory_model;
+          memory_model.activation_bytes_per_frame =
+              static_cast<std::size_t>(program.get<int>("--activation_kib_per_frame")) * 1024;
+          memory_model.token_conditioned = aligner.takes_token_ids();
+          memory_model.with_confidence = with_confidence || output_format == "json";
+
+          // 実行前に WAV のヘッダと音素数から各ファイルのメモリを見積もる
+          std::vector<domino::AlignmentJob> jobs;
           for (std::filesystem::directory_entry const &file : std::filesystem::directory_iterator{input_path}) {
             std::filesystem::path const wav_file = file.path();
             if (!std::filesystem::is_regular_file(wav_file) || (wav_file.extension() != ".wav")) {
               continue;
             }
-            std::string const wav_file_str{wav_file.string()};
-
-            ElapsedTimer const process_timer(wav_file_str.c_str());
-
+            domino::AlignmentJob job;
+            job.wav_file = wav_file;
             // pythonでいうところの Path.with_suffix()
-            std::filesystem::path const txt_file = with_suffix(wav_file, ".txt");
-            std::filesystem::path const output_file = with_suffix(wav_file, output_file_ext, output_dir);
-            std::filesystem::path const log_file = with_suffix(output_file, ".log");
-            std::vector<int> const phonemes_index = aligner.read_phonemes(txt_file);
-
-            std::vector<float> wav_data;
-            int load_result = load_wav(wav_file_str.c_str(), wav_data);
-            std::cout << "load_wav(" << load_result << "): " << wav_data.size() << std::endl;
-
-            auto const labels = aligner.align(wav_data.data(), wav_data.size(), phonemes_index, N);
-            if (program.get<std::string>("--output_format") == "lab") {
-              write_lab_file(labels, output_file);
-            } else {
-              write_textGrid_file(labels, output_file);
+            job.txt_file = with_suffix(wav_file, ".txt");
+            job.output_file = with_suffix(wav_file, output_file_ext, output_dir);
+            int const header_result = read_wav_num_samples(wav_file.string().c_str(), job.num_samples);
+            if (header_result != 0) {
+              std::cerr << "[warn] skip invalid wav file (" << header_result << "): " << wav_file << std::endl;
+              continue;
+            }
+            try {
+              job.token_ids = aligner.read_phonemes(job.txt_file);
+              job.num_tokens = job.token_ids.size();
+            } catch (std::exception const &e) {
+              std::cerr << "[warn] skip " << wav_file << ": " << e.what() << std::endl;
+              continue;
             }
+            job.estimated_bytes = memory_model.estimate_bytes(job.num_samples, job.num_tokens);
+            jobs.push_back(std::move(job));
+          }
+
+          std::size_t const memory_budget_bytes =
+              static_cast<std::size_t>(program.get<int>("--memory_budget")) * 1024 * 1024;
+          domino::JobScheduler scheduler(std::move(jobs), memory_budget_bytes);
+          if (scheduler.num_oversized_jobs() > 0) {
+            info_stream() << scheduler.num_oversized_jobs()
+                          << " file(s) exceed the memory budget and will run one at a time" << std::endl;
           }
+
+          run_pipeline(aligner, scheduler, pipeline_options, output_format, N, with_confidence, metrics_ofs,
+                       program.present<std::string>("--pipeline_stats_path"));
         } else if (std::filesystem::is_regular_file(input_path) && input_path.extension() == ".wav") {
           std::filesystem::path const &wav_file = input_path;
           std::string const wav_file_str{wav_file.string()};
@@ -187,7 +652,6 @@ int main(int argc, char *argv[]) {
           ElapsedTimer const process_timer(wav_file_str.c_str());
 
           std::filesystem::path const txt_file = with_suffix(wav_file, ".txt");
-          std::filesystem::path const log_file = with_suffix(wav_file, ".log");
           std::filesystem::path const output_file = [&program, &wav_file, &output_file_ext]() {
             if (program.present<std::string>("--output_path")) {
               return std::filesystem::path(program.present<std::string>("--output_path").value());
@@ -195,26 +659,21 @@ int main(int argc, char *argv[]) {
               return with_suffix(wav_file, output_file_ext);
             }
           }();
-          std::vector<int> const phonemes_index =
-              program.present<std::string>("--input_phoneme")
-                  ? aligner.read_phonemes(program.present<std::string>("--input_phoneme").value())
-                  : aligner.read_phonemes(txt_file);
-
-          std::vector<float> wav_data;
-          int load_result = load_wav(wav_file_str.c_str(), wav_data);
-          std::cout << "load_wav(" << load_result << "): " << wav_data.size() << std::endl;
-
-          auto const labels = aligner.align(wav_data.data(), wav_data.size(), phonemes_index, N);
-          if (program.get<std::string>("--output_format") == "lab") {
-            write_lab_file(labels, output_file);
-          } else {
-            write_textGrid_file(labels, output_file);
+          domino::Metrics const metrics = align_file(aligner, wav_file, program.present<std::string>("--input_phoneme"),
+                                                     txt_file, output_file, output_format, N, with_confidence);
+          if (metrics_ofs) {
+            metrics_ofs << metrics.to_json(wav_file_str) << std::endl;
           }
         } else {
           // エラー処理
           throw std::runtime_error("invalid input_path: " + input_path.string());
         }
       }
+
+      std::string const profile_file = aligner.end_profiling();
+      if (!profile_file.empty()) {
+        info_stream() << "ort profile: " << profile_file << std::endl;
+      }
     }
   } catch (Ort::Exception const &e) {
     std::cerr << e.what() << std::endl;
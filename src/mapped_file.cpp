@@ -0,0 +1,45 @@
+#include "mapped_file.hpp"
+
+#include <fstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace domino {
+MappedFile::MappedFile(std::filesystem::path const& file) : size_(std::filesystem::file_size(file)) {
+  if (size_ == 0) {
+    throw std::runtime_error("file is empty: " + file.string());
+  }
+#ifndef _WIN32
+  int const fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("failed to open file: " + file.string());
+  }
+  void* const data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw std::runtime_error("failed to mmap file: " + file.string());
+  }
+  data_ = data;
+#else
+  buffer_.resize(size_);
+  std::ifstream ifs(file, std::ios::binary);
+  if (!ifs.read(buffer_.data(), size_)) {
+    throw std::runtime_error("failed to read file: " + file.string());
+  }
+  data_ = buffer_.data();
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+  if (data_) {
+    munmap(data_, size_);
+  }
+#endif
+}
+}  // namespace domino
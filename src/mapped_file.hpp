@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <vector>
+
+namespace domino {
+/**
+ * @brief 読み込み専用でメモリにマップしたファイル。
+ * fork した子プロセスは親と同じ物理ページを参照するので、複数のプロセスで1つのモデルファイルを共有できる。
+ * mmap のない環境ではファイル全体をメモリに読み込む
+ */
+class MappedFile {
+ public:
+  MappedFile() = default;
+  explicit MappedFile(std::filesystem::path const& file);
+  ~MappedFile();
+
+  MappedFile(MappedFile const&) = delete;
+  MappedFile& operator=(MappedFile const&) = delete;
+
+  bool empty() const { return size_ == 0; }
+  void const* data() const { return data_; }
+  std::size_t size() const { return size_; }
+
+ private:
+  void* data_ = nullptr;
+  std::size_t size_ = 0;
+  // mmap できないときにファイルの内容を入れておくバッファ
+  std::vector<char> buffer_;
+};
+}  // namespace domino
@@ -0,0 +1,82 @@
+#include "metrics.hpp"
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+
+namespace domino {
+namespace {
+std::string escape_json(std::string const &s) {
+  std::string escaped;
+  escaped.reserve(s.size());
+  for (char const c : s) {
+    switch (c) {
+      case '"':
+        escaped += "\\\"";
+        break;
+      case '\\':
+        escaped += "\\\\";
+        break;
+      case '\n':
+        escaped += "\\n";
+        break;
+      case '\t':
+        escaped += "\\t";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char buf[8];
+          std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+          escaped += buf;
+        } else {
+          escaped += c;
+        }
+    }
+  }
+  return escaped;
+}
+}  // namespace
+
+void Metrics::add_time(std::string const &stage, double const elapsed_ms) {
+  for (auto &[name, value] : timings_ms_) {
+    if (name == stage) {
+      value += elapsed_ms;
+      return;
+    }
+  }
+  timings_ms_.emplace_back(stage, elapsed_ms);
+}
+
+void Metrics::set_count(std::string const &name, std::int64_t const value) {
+  for (auto &[key, count] : counts_) {
+    if (key == name) {
+      count = value;
+      return;
+    }
+  }
+  counts_.emplace_back(name, value);
+}
+
+void Metrics::clear() {
+  timings_ms_.clear();
+  counts_.clear();
+}
+
+std::string Metrics::to_json(std::string const &file) const {
+  std::ostringstream ss;
+  ss << "{";
+  if (!file.empty()) {
+    ss << "\"file\": \"" << escape_json(file) << "\", ";
+  }
+  ss << "\"timings_ms\": {";
+  for (std::size_t i = 0; i < timings_ms_.size(); ++i) {
+    ss << (i ? ", " : "") << "\"" << escape_json(timings_ms_[i].first) << "\": " << timings_ms_[i].second;
+  }
+  ss << "}, \"counts\": {";
+  for (std::size_t i = 0; i < counts_.size(); ++i) {
+    ss << (i ? ", " : "") << "\"" << escape_json(counts_[i].first) << "\": " << counts_[i].second;
+  }
+  ss << "}}";
+  return ss.str();
+}
+}  // namespace domino
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace domino {
+/**
+ * @brief 1回のアラインメントの各ステージの所要時間と、フレーム数・トークン数・確保したバイト数などを記録するクラス
+ *
+ */
+class Metrics {
+ public:
+  // 同じステージを複数回計測したときは合計する
+  void add_time(std::string const &stage, double const elapsed_ms);
+  void set_count(std::string const &name, std::int64_t const value);
+  void clear();
+
+  std::vector<std::pair<std::string, double>> const &timings_ms() const { return timings_ms_; }
+  std::vector<std::pair<std::string, std::int64_t>> const &counts() const { return counts_; }
+
+  // 1行の JSON。file が空でなければ "file" キーに入れる
+  std::string to_json(std::string const &file = "") const;
+
+ private:
+  std::vector<std::pair<std::string, double>> timings_ms_;
+  std::vector<std::pair<std::string, std::int64_t>> counts_;
+};
+
+/**
+ * @brief スコープを抜けるまでの時間を Metrics に記録するクラス。metrics が nullptr のときは何もしない
+ *
+ */
+class ScopedTimer {
+ public:
+  ScopedTimer(Metrics *metrics, char const *stage)
+      : metrics_(metrics), stage_(stage), start_(std::chrono::steady_clock::now()) {}
+  ScopedTimer(ScopedTimer const &) = delete;
+  ScopedTimer &operator=(ScopedTimer const &) = delete;
+
+  ~ScopedTimer() {
+    if (metrics_) {
+      std::chrono::duration<double, std::milli> const elapsed = std::chrono::steady_clock::now() - start_;
+      metrics_->add_time(stage_, elapsed.count());
+    }
+  }
+
+ private:
+  Metrics *const metrics_;
+  char const *const stage_;
+  std::chrono::steady_clock::time_point const start_;
+};
+}  // namespace domino
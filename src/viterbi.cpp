@@ -1,8 +1,13 @@
 ﻿#include "viterbi.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <limits>
+#include <numeric>
+#include <thread>
 #include <tuple>
 #include <vector>
 
@@ -33,6 +38,102 @@ int viterbi_init(float const* logprobs_transitions, float const* logprobs_blank,
   return 0;
 }
 
+namespace {
+// 並列版で1つのタイルが受け持つ音素遷移トークン数と時間フレーム数。
+// 8トークン分の (音素遷移, blank) の float はちょうど 64 バイトで、128 フレーム分のタイルは L1 キャッシュに収まる
+constexpr int kTokensPerTile = 8;
+constexpr int kTimeframesPerTile = 128;
+
+// これより小さい問題はスレッドの起動コストのほうが大きいので、並列版でも逐次版で解く
+constexpr int kMinTokensForParallel = 4 * kTokensPerTile;
+constexpr std::size_t kMinLatticeSizeForParallel = std::size_t(1) << 20;
+
+// 信頼度は、音素遷移が Viterbi の時刻の前後このフレーム数 (1フレーム10ミリ秒) 以内に起きる事後確率とする
+constexpr int kBoundaryToleranceFrames = 2;
+
+/**
+ * @brief 最初の blank と1番目の音素遷移トークンの前向き確率
+ */
+void forward_first_tokens(int const len_timeframes, std::size_t const num_tokens_with_blank,
+                          std::vector<float> const& log_emission_probs, std::vector<float>& forward_logprobs) {
+  forward_logprobs[0] = log_emission_probs[0];
+  forward_logprobs[1] = log_emission_probs[1];
+  for (std::size_t t = 1; t < len_timeframes; ++t) {
+    forward_logprobs[t * num_tokens_with_blank] =
+        forward_logprobs[(t - 1) * num_tokens_with_blank] + log_emission_probs[t * num_tokens_with_blank];
+  }
+
+  for (std::size_t t = 1; t < len_timeframes; ++t) {
+    forward_logprobs[t * num_tokens_with_blank + 1] =
+        forward_logprobs[(t - 1) * num_tokens_with_blank] + log_emission_probs[t * num_tokens_with_blank + 1];
+  }
+}
+
+/**
+ * @brief token_idx 番目の音素遷移トークンとその直前の blank の前向き確率を、時刻 [t_begin, t_end) について計算する。
+ * 読むのは token_idx - 2 番目の音素遷移トークンの t_end - min_aligned_time より前の前向き確率だけ
+ *
+ * @tparam TransitionFlags std::vector<bool> か、スレッド間で書き込みが干渉しない 1バイト1要素の配列
+ */
+template <typename TransitionFlags>
+void forward_transition_token(int const token_idx, int const t_begin, int const t_end,
+                              std::size_t const num_tokens_with_blank, std::size_t const num_tokens_without_blank,
+                              std::vector<float> const& log_emission_probs, std::vector<float>& forward_logprobs,
+                              TransitionFlags& is_transition, int const min_aligned_time) {
+  for (int t = t_begin; t < t_end; ++t) {
+    std::size_t const row = t * num_tokens_with_blank;
+    std::size_t const row_Nframes_ago = (t - min_aligned_time) * num_tokens_with_blank;
+
+    // i - 1番目の音素遷移が t - N フレーム目で遷移が起こっていたときの前向き確率
+    float forward_logprob_if_transit_Nframes_ago = forward_logprobs[row_Nframes_ago + token_idx - 2];
+    for (std::size_t s = t - min_aligned_time + 1; s < t; ++s) {
+      forward_logprob_if_transit_Nframes_ago += log_emission_probs[s * num_tokens_with_blank + token_idx - 1];
+    }
+
+    // i - 1番目の音素遷移が t - N フレーム目より前で遷移が起こっていたときの前向き確率
+    float forward_logprob_if_transit_before_Nframes;
+    if (t >= 2) {
+      forward_logprob_if_transit_before_Nframes = forward_logprobs[(t - 2) * num_tokens_with_blank + token_idx - 1] +
+                                                  log_emission_probs[(t - 1) * num_tokens_with_blank + token_idx - 1];
+    } else {
+      forward_logprob_if_transit_before_Nframes = -std::numeric_limits<float>::infinity();
+    }
+
+    is_transition[(t - min_aligned_time) * num_tokens_without_blank + (token_idx - 3) / 2] =
+        (forward_logprob_if_transit_Nframes_ago > forward_logprob_if_transit_before_Nframes);
+    forward_logprobs[row + token_idx] =
+        std::max(forward_logprob_if_transit_Nframes_ago, forward_logprob_if_transit_before_Nframes) +
+        log_emission_probs[row + token_idx];
+    forward_logprobs[(t - 1) * num_tokens_with_blank + token_idx - 1] =
+        forward_logprobs[row + token_idx] - log_emission_probs[row + token_idx];
+  }
+}
+
+/**
+ * @brief 最後の blank の前向き確率
+ */
+template <typename TransitionFlags>
+void forward_last_blank(int const len_timeframes, std::size_t const num_tokens_with_blank,
+                        std::size_t const num_tokens_without_blank, std::vector<float> const& log_emission_probs,
+                        std::vector<float>& forward_logprobs, TransitionFlags& is_transition,
+                        int const min_aligned_time) {
+  std::size_t const last_blank_idx = num_tokens_with_blank - 1;
+  for (std::size_t t = min_aligned_time; t < len_timeframes; ++t) {
+    forward_logprobs[t * num_tokens_with_blank + last_blank_idx] =
+        std::max(forward_logprobs[(t - 1) * num_tokens_with_blank + last_blank_idx - 1],
+                 forward_logprobs[(t - 1) * num_tokens_with_blank + last_blank_idx]) +
+        log_emission_probs[t * num_tokens_with_blank + last_blank_idx];
+    is_transition[(t - 1) * num_tokens_without_blank + num_tokens_without_blank - 1] =
+        forward_logprobs[(t - 1) * num_tokens_with_blank + last_blank_idx - 1] >
+        forward_logprobs[(t - 1) * num_tokens_with_blank + last_blank_idx];
+  }
+  std::size_t const last_t = len_timeframes - 1;
+  is_transition[last_t * num_tokens_without_blank + num_tokens_without_blank - 1] =
+      forward_logprobs[last_t * num_tokens_with_blank + last_blank_idx - 1] >
+      forward_logprobs[last_t * num_tokens_with_blank + last_blank_idx];
+}
+}  // namespace
+
 /**
  * @brief
  *
@@ -52,61 +153,90 @@ std::vector<float> viterbi_forward(int const len_timeframes, int const num_token
   std::vector<float> forward_logprobs(log_emission_probs.size(), -std::numeric_limits<float>::infinity());
   std::fill(is_transition.begin(), is_transition.end(), false);
 
-  forward_logprobs[0] = log_emission_probs[0];
-  forward_logprobs[1] = log_emission_probs[1];
-  for (int t = 1; t < len_timeframes; ++t) {
-    forward_logprobs[t * num_tokens_with_blank] =
-        forward_logprobs[(t - 1) * num_tokens_with_blank] + log_emission_probs[t * num_tokens_with_blank];
+  forward_first_tokens(len_timeframes, num_tokens_with_blank, log_emission_probs, forward_logprobs);
+  for (int token_idx = 3; token_idx < num_tokens_with_blank; token_idx += 2) {
+    forward_transition_token(token_idx, min_aligned_time * (token_idx - 1) / 2, len_timeframes, num_tokens_with_blank,
+                             num_tokens_without_blank, log_emission_probs, forward_logprobs, is_transition,
+                             min_aligned_time);
   }
+  forward_last_blank(len_timeframes, num_tokens_with_blank, num_tokens_without_blank, log_emission_probs,
+                     forward_logprobs, is_transition, min_aligned_time);
 
-  for (int t = 1; t < len_timeframes; ++t) {
-    forward_logprobs[t * num_tokens_with_blank + 1] =
-        forward_logprobs[(t - 1) * num_tokens_with_blank] + log_emission_probs[t * num_tokens_with_blank + 1];
+  return forward_logprobs;
+}
+
+/**
+ * @brief viterbi_forward の並列版。結果は viterbi_forward と完全に一致する
+ *
+ * token_idx 番目の音素遷移トークンの時刻 t の前向き確率は、token_idx - 2 番目の時刻 t - N 以前と自分自身の過去にしか依存しない。
+ * そこで格子を (kTimeframesPerTile フレーム x kTokensPerTile トークン) のタイルに分け、各スレッドがトークン方向の
+ * タイル列を先頭から順に取って時間方向に進める。1つ前のタイル列が必要な時刻まで進むのを待つので、
+ * タイルは反対角線に沿ったウェーブフロントとして処理される。問題が小さいときは viterbi_forward で解く
+ *
+ * @param num_threads 使うスレッド数 (呼び出し元のスレッドを含む)
+ */
+std::vector<float> viterbi_forward_parallel(int const len_timeframes, int const num_tokens_with_blank,
+                                            std::vector<float> const& log_emission_probs,
+                                            std::vector<bool>& is_transition, int const min_aligned_time,
+                                            int const num_threads) {
+  int const num_tokens_without_blank = (num_tokens_with_blank - 1) / 2;  // blankを含まない音素遷移トークン数
+  if (num_threads <= 1 || num_tokens_without_blank < kMinTokensForParallel ||
+      log_emission_probs.size() < kMinLatticeSizeForParallel) {
+    return viterbi_forward(len_timeframes, num_tokens_with_blank, log_emission_probs, is_transition,
+                           min_aligned_time);
   }
 
-  for (int token_idx = 3; token_idx < num_tokens_with_blank; token_idx += 2) {
-    for (int t = min_aligned_time * (token_idx - 1) / 2; t < len_timeframes; ++t) {
-      // i - 1番目の音素遷移が t - N フレーム目で遷移が起こっていたときの前向き確率
-      float forward_logprob_if_transit_Nframes_ago =
-          forward_logprobs[(t - min_aligned_time) * num_tokens_with_blank + token_idx - 2];
-      for (int s = t - min_aligned_time + 1; s < t; ++s) {
-        forward_logprob_if_transit_Nframes_ago += log_emission_probs[s * num_tokens_with_blank + token_idx - 1];
-      }
+  std::vector<float> forward_logprobs(log_emission_probs.size(), -std::numeric_limits<float>::infinity());
+  // std::vector<bool> は隣り合う要素が同じワードに入るため、スレッド間で書き込みが干渉しない 1バイト1要素で持つ
+  std::vector<std::uint8_t> transition_flags(is_transition.size(), 0);
 
-      // i - 1番目の音素遷移が t - N フレーム目より前で遷移が起こっていたときの前向き確率
-      float forward_logprob_if_transit_before_Nframes;
-      if (t >= 2) {
-        forward_logprob_if_transit_before_Nframes = forward_logprobs[(t - 2) * num_tokens_with_blank + token_idx - 1] +
-                                                    log_emission_probs[(t - 1) * num_tokens_with_blank + token_idx - 1];
-      } else {
-        forward_logprob_if_transit_before_Nframes = -std::numeric_limits<float>::infinity();
-      }
+  forward_first_tokens(len_timeframes, num_tokens_with_blank, log_emission_probs, forward_logprobs);
 
-      is_transition[(t - min_aligned_time) * num_tokens_without_blank + (token_idx - 3) / 2] =
-          (forward_logprob_if_transit_Nframes_ago > forward_logprob_if_transit_before_Nframes);
-      forward_logprobs[t * num_tokens_with_blank + token_idx] =
-          std::max(forward_logprob_if_transit_Nframes_ago, forward_logprob_if_transit_before_Nframes) +
-          log_emission_probs[t * num_tokens_with_blank + token_idx];
-      forward_logprobs[(t - 1) * num_tokens_with_blank + token_idx - 1] =
-          forward_logprobs[t * num_tokens_with_blank + token_idx] -
-          log_emission_probs[t * num_tokens_with_blank + token_idx];
-    }
+  // token_idx = 3, 5, ... の音素遷移トークンを kTokensPerTile 個ずつのタイル列に分ける
+  int const num_tile_columns = (num_tokens_without_blank - 1 + kTokensPerTile - 1) / kTokensPerTile;
+  // progress[c]: タイル列 c の最後のトークンの前向き確率が確定した時刻 (この時刻未満は確定済み)
+  std::vector<std::atomic<int>> progress(num_tile_columns);
+  for (std::atomic<int>& p : progress) {
+    p.store(0, std::memory_order_relaxed);
   }
+  std::atomic<int> next_tile_column{0};
 
-  // 最後のblank
-  int last_blank_idx = num_tokens_with_blank - 1;
-  for (int t = min_aligned_time; t < len_timeframes; ++t) {
-    forward_logprobs[t * num_tokens_with_blank + last_blank_idx] =
-        std::max(forward_logprobs[(t - 1) * num_tokens_with_blank + last_blank_idx - 1],
-                 forward_logprobs[(t - 1) * num_tokens_with_blank + last_blank_idx]) +
-        log_emission_probs[t * num_tokens_with_blank + last_blank_idx];
-    is_transition[(t - 1) * num_tokens_without_blank + num_tokens_without_blank - 1] =
-        forward_logprobs[(t - 1) * num_tokens_with_blank + last_blank_idx - 1] >
-        forward_logprobs[(t - 1) * num_tokens_with_blank + last_blank_idx];
+  auto worker = [&]() {
+    for (int c = next_tile_column.fetch_add(1); c < num_tile_columns; c = next_tile_column.fetch_add(1)) {
+      int const first_token_idx = 3 + 2 * kTokensPerTile * c;
+      int const last_token_idx = std::min(first_token_idx + 2 * kTokensPerTile, num_tokens_with_blank);
+      int const t_begin = min_aligned_time * (first_token_idx - 1) / 2;
+      for (int t0 = t_begin; t0 < len_timeframes;) {
+        int const t1 = std::min(len_timeframes, (t0 / kTimeframesPerTile + 1) * kTimeframesPerTile);
+        if (c > 0) {
+          while (progress[c - 1].load(std::memory_order_acquire) < t1 - min_aligned_time) {
+            std::this_thread::yield();
+          }
+        }
+        for (int token_idx = first_token_idx; token_idx < last_token_idx; token_idx += 2) {
+          forward_transition_token(token_idx, std::max(t0, min_aligned_time * (token_idx - 1) / 2), t1,
+                                   num_tokens_with_blank, num_tokens_without_blank, log_emission_probs,
+                                   forward_logprobs, transition_flags, min_aligned_time);
+        }
+        progress[c].store(t1, std::memory_order_release);
+        t0 = t1;
+      }
+      progress[c].store(len_timeframes, std::memory_order_release);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < num_threads; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread& thread : threads) {
+    thread.join();
   }
-  is_transition[(len_timeframes - 1) * num_tokens_without_blank + num_tokens_without_blank - 1] =
-      forward_logprobs[(len_timeframes - 1) * num_tokens_with_blank + last_blank_idx - 1] >
-      forward_logprobs[(len_timeframes - 1) * num_tokens_with_blank + last_blank_idx];
+
+  forward_last_blank(len_timeframes, num_tokens_with_blank, num_tokens_without_blank, log_emission_probs,
+                     forward_logprobs, transition_flags, min_aligned_time);
+  std::copy(transition_flags.begin(), transition_flags.end(), is_transition.begin());
 
   return forward_logprobs;
 }
@@ -128,7 +258,7 @@ int viterbi_backtrace(int const len_timeframes, int const num_tokens_without_bla
   int t = len_timeframes - 1;
   int i = num_tokens_without_blank - 1;
   while (t >= 0 && i >= 0) {
-    if (is_transition[t * num_tokens_without_blank + i]) {
+    if (is_transition[static_cast<std::size_t>(t) * num_tokens_without_blank + i]) {
       transition_timeframes[i] = t;
       t -= min_aligned_time;
       --i;
@@ -140,21 +270,194 @@ int viterbi_backtrace(int const len_timeframes, int const num_tokens_without_bla
   return 0;
 }
 
+/**
+ * @brief 前向き後ろ向きアルゴリズムで、Viterbi で求めた各音素遷移の時刻の事後確率を求める
+ *
+ * 格子上の経路のスコアは、全フレームの blank の対数確率の和に、j番目の音素遷移が起きた時刻 τ_j での
+ * (音素遷移の対数確率 - blank の対数確率) を足したものになる。制約は τ_j - τ_{j-1} >= min_aligned_time だけなので、
+ * 前向き確率・後ろ向き確率は 1つ前 (後ろ) のトークンの累積和からトークンごとに O(T) で求まる。
+ * logsumexp の代わりに、トークンごとに最大値が 1 になるよう正規化した確率そのものを足し合わせる
+ *
+ * @param len_timeframes 時間フレーム数
+ * @param num_tokens_with_blank blankトークンを含んだうえでの入力トークン数
+ * @param log_emission_probs viterbi_init で作った出力確率
+ * @param min_aligned_time 1音素に割り当てる最小時間フレーム数
+ * @param transition_timeframes viterbi_backtrace で求めた音素遷移の時刻
+ * @param tolerance この前後フレーム数以内に音素遷移が起きる事後確率を信頼度とする
+ * @param boundary_confidences 結果を入力する変数
+ * @return double 全経路についての対数尤度
+ */
+double viterbi_posterior(int const len_timeframes, int const num_tokens_with_blank,
+                         std::vector<float> const& log_emission_probs, int const min_aligned_time,
+                         std::vector<int> const& transition_timeframes, int const tolerance,
+                         std::vector<float>& boundary_confidences) {
+  std::size_t const num_tokens_without_blank = (num_tokens_with_blank - 1) / 2;
+  std::size_t const T = len_timeframes;
+  std::size_t const N = min_aligned_time;
+
+  // scaled_gains[j * T + t]: j番目の音素遷移が時刻 t に起きたときの (音素遷移の確率 / blank の確率) をトークンごとの
+  // 最大値で割ったもの。前向き・後ろ向きの計算はトークンごとに時間方向に進むので、トークン優先の並びにしておく
+  std::vector<float> scaled_gains(num_tokens_without_blank * T);
+  std::vector<double> max_gains(num_tokens_without_blank, -std::numeric_limits<double>::infinity());
+  for (std::size_t t = 0; t < T; ++t) {
+    float const* const row = &log_emission_probs[t * num_tokens_with_blank];
+    for (std::size_t j = 0; j < num_tokens_without_blank; ++j) {
+      float const gain = row[2 * j + 1] - row[2 * j];
+      scaled_gains[j * T + t] = gain;
+      max_gains[j] = std::max<double>(max_gains[j], gain);
+    }
+  }
+  for (std::size_t j = 0; j < num_tokens_without_blank; ++j) {
+    float const max_gain = max_gains[j];
+    std::transform(scaled_gains.begin() + j * T, scaled_gains.begin() + (j + 1) * T, scaled_gains.begin() + j * T,
+                   [max_gain](float const gain) { return std::exp(gain - max_gain); });
+  }
+  // 最大値で割って、割った値の対数を返す
+  auto normalize = [](double* const first, double* const last) {
+    double const max_value = *std::max_element(first, last);
+    if (max_value > 0.0) {
+      std::transform(first, last, first, [max_value](double const x) { return x / max_value; });
+    }
+    return std::log(max_value);
+  };
+
+  // backward_probs[j * T + t]: j番目の音素遷移が時刻 t に起きたときの、j+1番目以降の音素遷移の確率の和 (の定数倍)
+  std::vector<double> backward_probs(num_tokens_without_blank * T);
+  std::fill(backward_probs.end() - T, backward_probs.end(), 1.0);
+  for (std::size_t j = num_tokens_without_blank - 1; j-- > 0;) {
+    double const* const next = &backward_probs[(j + 1) * T];
+    float const* const gains_next = &scaled_gains[(j + 1) * T];
+    double* const curr = &backward_probs[j * T];
+    double cumulative = 0.0;  // Σ_{s >= t + N} gain(j + 1, s) * next[s]
+    for (std::size_t t = T; t-- > 0;) {
+      if (t + N < T) {
+        cumulative += gains_next[t + N] * next[t + N];
+      }
+      curr[t] = cumulative;
+    }
+    normalize(curr, curr + T);
+  }
+
+  // forward_probs[t]: 0〜j番目の音素遷移のうち j番目が時刻 t に起きる経路の確率の和 (の定数倍)
+  std::vector<double> forward_probs(T);
+  std::vector<double> prev_forward_probs(T);
+  double log_scale = 0.0;  // forward_probs に掛かっている定数倍の対数
+  boundary_confidences.assign(num_tokens_without_blank, 0.0f);
+  for (std::size_t j = 0; j < num_tokens_without_blank; ++j) {
+    float const* const gains = &scaled_gains[j * T];
+    double cumulative = 0.0;  // Σ_{s <= t - N} prev[s]
+    for (std::size_t t = 0; t < T; ++t) {
+      if (j == 0) {
+        cumulative = 1.0;
+      } else if (t >= N) {
+        cumulative += prev_forward_probs[t - N];
+      }
+      forward_probs[t] = cumulative * gains[t];
+    }
+    log_scale += max_gains[j] + normalize(forward_probs.data(), forward_probs.data() + T);
+
+    // どの経路も j番目の音素遷移をちょうど1回通るので、前向き確率と後ろ向き確率の積の時刻についての和で割れば事後確率になる
+    double const* const backward = &backward_probs[j * T];
+    std::size_t const t_begin = std::max(0, transition_timeframes[j] - tolerance);
+    std::size_t const t_end = std::min(len_timeframes, transition_timeframes[j] + tolerance + 1);
+    double total = 0.0, within_tolerance = 0.0;
+    for (std::size_t t = 0; t < T; ++t) {
+      double const prob = forward_probs[t] * backward[t];
+      total += prob;
+      if (t_begin <= t && t < t_end) {
+        within_tolerance += prob;
+      }
+    }
+    boundary_confidences[j] = total > 0.0 ? std::min(1.0, within_tolerance / total) : 0.0;
+    std::swap(forward_probs, prev_forward_probs);
+  }
+
+  // 最後の音素遷移の前向き確率の和に、定数倍と全フレームの blank の対数確率を足す
+  double total_logprob =
+      log_scale + std::log(std::accumulate(prev_forward_probs.begin(), prev_forward_probs.end(), 0.0));
+  for (std::size_t t = 0; t < T; ++t) {
+    total_logprob += log_emission_probs[t * num_tokens_with_blank];
+  }
+  return total_logprob;
+}
+
+/**
+ * @brief Viterbi で求めた経路について、音素ごとに割り当てたフレームの平均対数尤度を求める
+ *
+ * i番目の音素には、i-1番目の音素遷移が起きたフレーム (音素遷移の対数確率) と、i番目の音素遷移の直前までのフレーム
+ * (blank の対数確率) が割り当てられる
+ *
+ * @param segment_logprobs 結果を入力する変数。フレームが割り当てられなかった音素は、平均が定義できないので NaN
+ * @return double 経路の対数尤度 (全フレームの和)
+ */
+double viterbi_segment_logprobs(int const len_timeframes, int const num_tokens_with_blank,
+                                std::vector<float> const& log_emission_probs,
+                                std::vector<int> const& transition_timeframes, std::vector<float>& segment_logprobs) {
+  std::size_t const num_tokens_without_blank = (num_tokens_with_blank - 1) / 2;
+  segment_logprobs.assign(num_tokens_without_blank + 1, std::numeric_limits<float>::quiet_NaN());
+  double path_logprob = 0.0;
+  for (std::size_t i = 0; i <= num_tokens_without_blank; ++i) {
+    std::size_t const t_begin = i == 0 ? 0 : transition_timeframes[i - 1];
+    std::size_t const t_end = i == num_tokens_without_blank ? len_timeframes : transition_timeframes[i];
+    if (t_end <= t_begin) {
+      continue;
+    }
+    double logprob = 0.0;
+    for (std::size_t t = t_begin; t < t_end; ++t) {
+      // 先頭のフレームは i-1番目の音素遷移、残りは i番目の音素遷移の前の blank
+      std::size_t const token_idx = (i > 0 && t == t_begin) ? 2 * i - 1 : 2 * i;
+      logprob += log_emission_probs[t * num_tokens_with_blank + token_idx];
+    }
+    segment_logprobs[i] = logprob / (t_end - t_begin);
+    path_logprob += logprob;
+  }
+  return path_logprob;
+}
+
 int solve_viterbi(int const len_time_frame,
                   int const size_transition_vocab,               // size_transition_vocab
                   float const* transition_logprobs,              // len_time_frame x size_transition_vocab
                   float const* blank_logprobs,                   // len_time_frame
                   int const min_match_timeframes_per_1_phoneme,  // min match frame length per 1 phoneme
                   std::vector<int> const& token_ids,             // a int sequence
-                  std::vector<int>& transition_timeframes) {
+                  std::vector<int>& transition_timeframes,
+                  int const num_threads,
+                  domino::Metrics* metrics,
+                  ViterbiScores* scores) {
   int const num_tokens_with_blank = token_ids.size() * 2 + 1;
-  std::vector<float> log_emission_probs(len_time_frame * num_tokens_with_blank);
-  viterbi_init(transition_logprobs, blank_logprobs, token_ids, len_time_frame, size_transition_vocab,
-               log_emission_probs);
+  std::vector<float> log_emission_probs(static_cast<std::size_t>(len_time_frame) * num_tokens_with_blank);
   std::vector<bool> is_transition(log_emission_probs.size(), false);
-  viterbi_forward(len_time_frame, num_tokens_with_blank, log_emission_probs, is_transition,
-                  min_match_timeframes_per_1_phoneme);
-  viterbi_backtrace(len_time_frame, token_ids.size(), is_transition, min_match_timeframes_per_1_phoneme,
-                    transition_timeframes);
+  if (metrics) {
+    // log_emission_probs と forward_logprobs が float、is_transition が 1bit
+    metrics->set_count("viterbi_bytes", log_emission_probs.size() * (2 * sizeof(float)) + is_transition.size() / 8);
+  }
+  {
+    domino::ScopedTimer const timer(metrics, "viterbi_init");
+    viterbi_init(transition_logprobs, blank_logprobs, token_ids, len_time_frame, size_transition_vocab,
+                 log_emission_probs);
+  }
+  {
+    domino::ScopedTimer const timer(metrics, "viterbi_forward");
+    viterbi_forward_parallel(len_time_frame, num_tokens_with_blank, log_emission_probs, is_transition,
+                             min_match_timeframes_per_1_phoneme, num_threads);
+  }
+  {
+    domino::ScopedTimer const timer(metrics, "viterbi_backtrace");
+    viterbi_backtrace(len_time_frame, token_ids.size(), is_transition, min_match_timeframes_per_1_phoneme,
+                      transition_timeframes);
+  }
+  if (scores) {
+    if (metrics) {
+      // トークン優先に並べ替えた確率の比が float、後ろ向き確率が double
+      metrics->set_count("viterbi_posterior_bytes",
+                         static_cast<std::size_t>(len_time_frame) * token_ids.size() * (sizeof(float) + sizeof(double)));
+    }
+    domino::ScopedTimer const timer(metrics, "viterbi_posterior");
+    scores->total_logprob =
+        viterbi_posterior(len_time_frame, num_tokens_with_blank, log_emission_probs, min_match_timeframes_per_1_phoneme,
+                          transition_timeframes, kBoundaryToleranceFrames, scores->boundary_confidences);
+    scores->path_logprob = viterbi_segment_logprobs(len_time_frame, num_tokens_with_blank, log_emission_probs,
+                                                    transition_timeframes, scores->segment_logprobs);
+  }
   return 0;
 }
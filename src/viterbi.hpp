@@ -3,6 +3,21 @@
 #include <tuple>
 #include <vector>
 
+#include "metrics.hpp"
+
+// 前向き後ろ向きアルゴリズムで求めるアラインメントの信頼度
+struct ViterbiScores {
+  // boundary_confidences[j]: j番目の音素遷移が、Viterbi で求めた時刻の前後数フレーム以内に起きる事後確率
+  std::vector<float> boundary_confidences;
+  // segment_logprobs[i]: i番目の音素に割り当てたフレームの、1フレームあたりの平均対数尤度 (音素遷移トークン数 + 1 個)。
+  // フレームが1つも割り当てられなかった音素は NaN
+  std::vector<float> segment_logprobs;
+  // Viterbi で求めた経路の対数尤度 (全フレームの和)
+  double path_logprob = 0.0;
+  // 最小フレーム数の制約を満たすすべての経路についての対数尤度 (全フレームの和)
+  double total_logprob = 0.0;
+};
+
 int viterbi_init(float const* logprobs_transitions, float const* logprobs_blank, std::vector<int> const& token_ids,
                  int const len_timeframes, int const num_transition_vocab, std::vector<float>& log_emission_probs);
 
@@ -10,10 +25,25 @@ std::vector<float> viterbi_forward(int const len_timeframes, int const num_token
                                    std::vector<float> const& log_emission_probs, std::vector<bool>& is_transition,
                                    int const min_aligned_time);
 
+std::vector<float> viterbi_forward_parallel(int const len_timeframes, int const num_tokens_with_blank,
+                                            std::vector<float> const& log_emission_probs,
+                                            std::vector<bool>& is_transition, int const min_aligned_time,
+                                            int const num_threads);
+
+double viterbi_posterior(int const len_timeframes, int const num_tokens_with_blank,
+                         std::vector<float> const& log_emission_probs, int const min_aligned_time,
+                         std::vector<int> const& transition_timeframes, int const tolerance,
+                         std::vector<float>& boundary_confidences);
+
+double viterbi_segment_logprobs(int const len_timeframes, int const num_tokens_with_blank,
+                                std::vector<float> const& log_emission_probs,
+                                std::vector<int> const& transition_timeframes, std::vector<float>& segment_logprobs);
+
 int viterbi_backtrace(int const len_timeframes, int const num_tokens_without_blank,
                       std::vector<bool> const& is_transition, int const min_aligned_timeframe,
                       std::vector<int>& transition_timeframes);
 
 int solve_viterbi(int const len_time_frame, int const size_transition_vocab, float const* transition_logprobs,
                   float const* blank_logprobs, int const min_match_timeframes_per_1_phoneme,
-                  std::vector<int> const& token_ids, std::vector<int>& transition_timeframes);
\ No newline at end of file
+                  std::vector<int> const& token_ids, std::vector<int>& transition_timeframes,
+                  int const num_threads = 1, domino::Metrics* metrics = nullptr, ViterbiScores* scores = nullptr);
\ No newline at end of file